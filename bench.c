@@ -0,0 +1,1939 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Benchmark of the library alone: scripted client requests are fed from
+ * memory to a synthetic backend. Each workload runs through
+ * tinyiiod_read_command() and through tinyiiod_feed(). Its script is run
+ * once with the responses recorded and checked against what every command
+ * should get back, then again until the measure is long enough. A
+ * response that doesn't match, or a failing call, fails the workload.
+ * One JSON object is printed per line:
+ *
+ *   workload, transport, size    what was run
+ *   buffer_size                  buffer_size of the instance
+ *   clients                      instances fed in turn, like a server
+ *   baud                         serial link the time includes, or 0
+ *   commands, seconds            how many commands (and stream blocks),
+ *                                how long
+ *   commands_per_sec
+ *   mb_per_sec                   bytes through the transport, both ways
+ *   callbacks_per_command        backend ops called
+ *   io_calls_per_command         transport ops called
+ *   mem_size                     memory of the instance
+ *   allocs_per_command           malloc() and friends called by the
+ *                                library, null when they can't be counted
+ *
+ * Usage: tinyiiod-bench [-n count] [-c chunk] [-t seconds] [workload...]
+ *
+ * count is the number of commands of a script (default 20000, fewer for
+ * big buffers), chunk the size of the tinyiiod_feed() calls and seconds
+ * the minimum duration of a measure: the script is run again until then.
+ * With -t 0, every workload is checked and run once.
+ */
+
+#define _GNU_SOURCE
+
+#include "tinyiiod.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_COMMANDS		20000
+#define BENCH_BYTES		(16 << 20)
+#define BENCH_CHUNK		1460
+#define BENCH_SECONDS		0.2
+#define BENCH_SAMPLES_SIZE	0x10000
+#define BENCH_ARENA_SIZE	0x10000
+#define BENCH_TABLE_ATTRS	1024
+#define BENCH_PAUSES		4
+#define BENCH_UART_BAUD		115200
+
+/* glibc lets the allocator be wrapped from the executable */
+#ifdef __GLIBC__
+#define BENCH_COUNT_ALLOCS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocs;
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+struct buffer {
+	char *buf;
+	size_t len, size;
+};
+
+enum reply_kind {
+	REPLY_STATUS,		/* A status line, or a header without data */
+	REPLY_LINE,		/* VERSION: a line, without status in text */
+	REPLY_DATA,		/* value bytes of data; any length if negative */
+	REPLY_ZDATA,		/* Compressed data of value bytes */
+	REPLY_SAMPLES,		/* READBUF: value bytes in blocks, mask first */
+	REPLY_WRITEBUF,		/* value before and after the payload */
+	REPLY_STREAM,		/* Status 0 and the mask, then blocks */
+};
+
+/* What the client expects back from one command */
+struct reply {
+	enum reply_kind kind;
+	int32_t value;
+	size_t mask_words;
+	bool binary;
+};
+
+#define STATUS(value)		reply(REPLY_STATUS, (int32_t) (value), 0)
+#define LINE			reply(REPLY_LINE, 0, 0)
+#define DATA(len)		reply(REPLY_DATA, (int32_t) (len), 0)
+#define ZDATA(len)		reply(REPLY_ZDATA, (int32_t) (len), 0)
+#define SAMPLES(len, words)	reply(REPLY_SAMPLES, (int32_t) (len), (words))
+#define WRITEBUF(len)		reply(REPLY_WRITEBUF, (int32_t) (len), 0)
+
+/* The client stays quiet while the stream pushes blocks blocks */
+struct pause {
+	size_t offset, size;
+	unsigned int blocks;
+};
+
+struct script {
+	struct buffer data;
+	unsigned int commands;
+
+	/* Expected reply of each command */
+	struct reply *replies;
+	size_t replies_size;
+
+	struct pause pauses[BENCH_PAUSES];
+	unsigned int nb_pauses, blocks;
+};
+
+struct bench {
+	/* Client side of the loopback */
+	const struct script *script;
+	size_t in_pos;
+	unsigned int pause, polls;
+	unsigned long long out_bytes;
+
+	/* Responses, recorded while the script is checked */
+	struct buffer *capture;
+
+	unsigned long callbacks, io_calls, own_allocs;
+
+	/* Size of the last waveform uploaded to the DAC */
+	size_t waveform;
+
+	/* Size of the transfer started by the asynchronous ops */
+	size_t transfer;
+
+	/* Blocks submitted to the capture pipeline, and their size */
+	unsigned int queued;
+	size_t block;
+};
+
+static char samples[BENCH_SAMPLES_SIZE];
+static char dac_buf[BENCH_SAMPLES_SIZE];
+
+/* Memory of the static instances */
+static unsigned long long arena[BENCH_ARENA_SIZE / sizeof(unsigned long long)];
+
+static const char * const xml =
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?><!DOCTYPE context [<!ELEMENT context "
+	"(device)*><!ELEMENT device (channel | attribute | debug-attribute | buffer-attribute)*><!ELEMENT "
+	"channel (scan-element?, attribute*)><!ELEMENT attribute EMPTY><!ELEMENT "
+	"scan-element EMPTY><!ELEMENT debug-attribute EMPTY><!ELEMENT buffer-attribute EMPTY><!ATTLIST context name "
+	"CDATA #REQUIRED description CDATA #IMPLIED><!ATTLIST device id CDATA "
+	"#REQUIRED name CDATA #IMPLIED><!ATTLIST channel id CDATA #REQUIRED type "
+	"(input|output) #REQUIRED name CDATA #IMPLIED><!ATTLIST scan-element index "
+	"CDATA #REQUIRED format CDATA #REQUIRED scale CDATA #IMPLIED><!ATTLIST "
+	"attribute name CDATA #REQUIRED filename CDATA #IMPLIED><!ATTLIST "
+	"debug-attribute name CDATA #REQUIRED><!ATTLIST buffer-attribute name "
+	"CDATA #REQUIRED value CDATA #IMPLIED>]><context name=\"bench\" "
+	"description=\"tinyiiod benchmark\" >"
+	"<device id=\"0\" name=\"adc\" >"
+	"<channel id=\"voltage0\" type=\"input\" >"
+	"<scan-element index=\"0\" format=\"le:s16/16&gt;&gt;0\" />"
+	"<attribute name=\"scale\" /><attribute name=\"raw\" /></channel>"
+	"<channel id=\"voltage1\" type=\"input\" >"
+	"<scan-element index=\"1\" format=\"le:s16/16&gt;&gt;0\" />"
+	"<attribute name=\"scale\" /><attribute name=\"raw\" /></channel>"
+	"<attribute name=\"sample_rate\" />"
+	"<debug-attribute name=\"direct_reg_access\" />"
+	"<buffer-attribute name=\"length_align_bytes\" />"
+	"</device>"
+	"<device id=\"1\" name=\"dac\" >"
+	"<channel id=\"voltage0\" type=\"output\" >"
+	"<scan-element index=\"0\" format=\"le:s16/16&gt;&gt;0\" />"
+	"<attribute name=\"raw\" /></channel>"
+	"<attribute name=\"fir_coeffs\" />"
+	"</device></context>";
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+static void buffer_append(struct buffer *b, const void *data, size_t len)
+{
+	size_t size = b->size ? b->size : 4096;
+
+	while (b->len + len > size)
+		size *= 2;
+
+	if (size != b->size) {
+		b->buf = xrealloc(b->buf, size);
+		b->size = size;
+	}
+
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+}
+
+/* Pause of the client still to come, if any */
+static const struct pause *next_pause(const struct bench *b)
+{
+	const struct script *s = b->script;
+
+	return b->pause < s->nb_pauses ? &s->pauses[b->pause] : NULL;
+}
+
+static ssize_t bench_read(void *priv, char *buf, size_t len)
+{
+	struct bench *b = priv;
+	const struct buffer *in = &b->script->data;
+
+	b->io_calls++;
+
+	if (len > in->len - b->in_pos)
+		return -EIO;
+
+	memcpy(buf, in->buf + b->in_pos, len);
+	b->in_pos += len;
+
+	return (ssize_t) len;
+}
+
+static ssize_t bench_read_avail(void *priv, char *buf, size_t len)
+{
+	struct bench *b = priv;
+	const struct buffer *in = &b->script->data;
+	const struct pause *p = next_pause(b);
+
+	b->io_calls++;
+
+	if (b->in_pos == in->len)
+		return -EIO;
+
+	if (len > in->len - b->in_pos)
+		len = in->len - b->in_pos;
+
+	/* What follows the pause isn't sent yet */
+	if (p && b->in_pos < p->offset && len > p->offset - b->in_pos)
+		len = p->offset - b->in_pos;
+
+	memcpy(buf, in->buf + b->in_pos, len);
+	b->in_pos += len;
+
+	return (ssize_t) len;
+}
+
+/* Polled between the blocks of a stream */
+static bool bench_read_ready(void *priv)
+{
+	struct bench *b = priv;
+	const struct pause *p = next_pause(b);
+
+	if (p && b->in_pos == p->offset) {
+		if (b->polls++ < p->blocks)
+			return false;
+
+		b->pause++;
+		b->polls = 0;
+	}
+
+	return b->in_pos != b->script->data.len;
+}
+
+static ssize_t bench_write(void *priv, const char *buf, size_t len)
+{
+	struct bench *b = priv;
+
+	b->io_calls++;
+	b->out_bytes += len;
+
+	if (b->capture)
+		buffer_append(b->capture, buf, len);
+
+	return (ssize_t) len;
+}
+
+static ssize_t bench_writev(void *priv, const struct tinyiiod_iovec *iov,
+			    size_t iovcnt)
+{
+	struct bench *b = priv;
+	size_t i, len = 0;
+
+	b->io_calls++;
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].len;
+		if (b->capture)
+			buffer_append(b->capture, iov[i].buf, iov[i].len);
+	}
+	b->out_bytes += len;
+
+	return (ssize_t) len;
+}
+
+static ssize_t read_attr(void *priv, const char *device, const char *attr,
+			 char *buf, size_t len, enum iio_attr_type type)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	return (ssize_t) snprintf(buf, len, "1000");
+}
+
+static ssize_t write_attr(void *priv, const char *device, const char *attr,
+			  const char *buf, size_t len, enum iio_attr_type type)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	return (ssize_t) len;
+}
+
+static ssize_t ch_read_attr(void *priv, const char *device,
+			    const char *channel, bool ch_out,
+			    const char *attr, char *buf, size_t len)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	return (ssize_t) snprintf(buf, len, "256");
+}
+
+static ssize_t ch_write_attr(void *priv, const char *device,
+			     const char *channel, bool ch_out,
+			     const char *attr, const char *buf, size_t len)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	return (ssize_t) len;
+}
+
+static int32_t open_buffer(void *priv, const char *device,
+			   size_t sample_size, uint32_t mask, bool cyclic)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	b->queued = 0;
+
+	return 0;
+}
+
+static int32_t open_mask(void *priv, const char *device,
+			 size_t sample_size, const uint32_t *mask,
+			 size_t mask_words, bool cyclic)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	b->queued = 0;
+
+	return mask_words == 2 ? 0 : -EINVAL;
+}
+
+static int32_t close_buffer(void *priv, const char *device)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	b->queued = 0;
+
+	return 0;
+}
+
+static int32_t get_mask(void *priv, const char *device, uint32_t *mask)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	*mask = 0x3;
+
+	return 0;
+}
+
+/* Only voltage0 enabled, for the ADC capturing both channels */
+static int32_t get_first_mask(void *priv, const char *device, uint32_t *mask)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	*mask = 0x1;
+
+	return 0;
+}
+
+/* An ADC with 64 scan channels, two of them enabled */
+static int32_t get_mask_words(void *priv, const char *device,
+			      uint32_t *mask, size_t *mask_words)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	if (*mask_words < 2)
+		return -ENOSPC;
+
+	mask[0] = 0x3;
+	mask[1] = 0x1;
+	*mask_words = 2;
+
+	return 0;
+}
+
+static ssize_t transfer_dev_to_mem(void *priv, const char *device,
+				   size_t bytes_count)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t read_data(void *priv, const char *device, char *buf,
+			 size_t offset, size_t bytes_count)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	offset %= sizeof(samples);
+	if (bytes_count > sizeof(samples) - offset)
+		bytes_count = sizeof(samples) - offset;
+
+	memcpy(buf, samples + offset, bytes_count);
+
+	return (ssize_t) bytes_count;
+}
+
+/* Full scans of both channels, whatever the mask */
+static ssize_t get_scans_ptr(void *priv, const char *device, char **buf,
+			     size_t offset, size_t bytes_count)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	offset %= sizeof(samples);
+	if (bytes_count > sizeof(samples) - offset)
+		bytes_count = sizeof(samples) - offset;
+
+	*buf = samples + offset;
+
+	return (ssize_t) bytes_count;
+}
+
+/* DMA ring of the pipelined READBUF, filled as soon as submitted */
+static int32_t submit_block(void *priv, const char *device,
+			    size_t bytes_count)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	if (bytes_count > sizeof(samples))
+		return -EINVAL;
+
+	b->block = bytes_count;
+	b->queued++;
+
+	return 0;
+}
+
+static ssize_t dequeue_block(void *priv, const char *device, char **buf,
+			     bool *overrun)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	if (!b->queued)
+		return -EIO;
+
+	b->queued--;
+	*buf = samples;
+	*overrun = false;
+
+	return (ssize_t) b->block;
+}
+
+static ssize_t transfer_mem_to_dev(void *priv, const char *device,
+				   size_t bytes_count)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	return (ssize_t) bytes_count;
+}
+
+/* DMA that completes when drive() gets back control */
+static ssize_t start_transfer(void *priv, const char *device,
+			      size_t bytes_count)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	b->transfer = bytes_count;
+
+	return -EINPROGRESS;
+}
+
+static ssize_t write_data(void *priv, const char *device, const char *buf,
+			  size_t offset, size_t bytes_count)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	b->waveform = offset + bytes_count;
+
+	offset %= sizeof(dac_buf);
+	if (bytes_count > sizeof(dac_buf) - offset)
+		bytes_count = sizeof(dac_buf) - offset;
+
+	memcpy(dac_buf + offset, buf, bytes_count);
+
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t get_write_ptr(void *priv, const char *device, char **buf,
+			     size_t offset, size_t bytes_count)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	b->waveform = offset + bytes_count;
+
+	offset %= sizeof(dac_buf);
+	if (bytes_count > sizeof(dac_buf) - offset)
+		bytes_count = sizeof(dac_buf) - offset;
+
+	*buf = dac_buf + offset;
+
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t rearm(void *priv, const char *device)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	return b->waveform ? (ssize_t) b->waveform : -ENOENT;
+}
+
+/* FIR coefficients of the DAC: a value way bigger than the buffer */
+static ssize_t read_attr_chunk(void *priv, const char *device,
+			       const char *channel, bool ch_out,
+			       const char *attr, enum iio_attr_type type,
+			       char *buf, size_t offset, size_t len,
+			       size_t *size)
+{
+	struct bench *b = priv;
+
+	if (channel || strcmp(attr, "fir_coeffs"))
+		return -ENOSYS;
+
+	b->callbacks++;
+	*size = sizeof(samples);
+
+	if (len > sizeof(samples) - offset)
+		len = sizeof(samples) - offset;
+	memcpy(buf, samples + offset, len);
+
+	return (ssize_t) len;
+}
+
+static int32_t write_attr_chunk(void *priv, const char *device,
+				const char *channel, bool ch_out,
+				const char *attr, enum iio_attr_type type,
+				const char *buf, size_t offset, size_t len,
+				size_t size)
+{
+	struct bench *b = priv;
+
+	if (channel || strcmp(attr, "fir_coeffs"))
+		return -ENOSYS;
+
+	b->callbacks++;
+
+	if (size > sizeof(dac_buf))
+		return -ENOSPC;
+	memcpy(dac_buf + offset, buf, len);
+
+	return 0;
+}
+
+/* Settings that only change when written */
+static enum tinyiiod_cache_policy get_cache_policy(void *priv,
+		const char *device, const char *channel, bool ch_out,
+		const char *attr, enum iio_attr_type type, uint32_t *ttl_us)
+{
+	return TINYIIOD_CACHE_UNTIL_WRITTEN;
+}
+
+static ssize_t get_xml(void *priv, char **outxml)
+{
+	struct bench *b = priv;
+	size_t len = strlen(xml);
+
+	b->callbacks++;
+	b->own_allocs++;
+
+	*outxml = malloc(len + 1);
+	if (!*outxml)
+		return -ENOMEM;
+	memcpy(*outxml, xml, len + 1);
+
+	return (ssize_t) len;
+}
+
+static void release_xml(void *priv, char *xml)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	free(xml);
+}
+
+/* A constant XML, with nothing to release */
+static ssize_t get_static_xml(void *priv, char **outxml)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+	*outxml = (char *) xml;
+
+	return (ssize_t) strlen(xml);
+}
+
+/* Context of the attr_poll_table workload: a device with a register map */
+static ssize_t read_table_attr(void *priv,
+			       const struct tinyiiod_attr_desc *attr,
+			       char *buf, size_t len)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	return (ssize_t) snprintf(buf, len, "1000");
+}
+
+static ssize_t write_table_attr(void *priv,
+				const struct tinyiiod_attr_desc *attr,
+				const char *buf, size_t len)
+{
+	struct bench *b = priv;
+
+	b->callbacks++;
+
+	return (ssize_t) len;
+}
+
+static const struct tinyiiod_attr_desc voltage_attrs[] = {
+	{ "raw", read_table_attr, write_table_attr, NULL },
+	{ "scale", read_table_attr, NULL, NULL },
+};
+
+static const struct tinyiiod_channel_desc table_channels[] = {
+	{ "voltage0", NULL, false, "le:s16/16>>0", 0,
+	  TINYIIOD_TABLE(voltage_attrs) },
+	{ "voltage1", NULL, false, "le:s16/16>>0", 1,
+	  TINYIIOD_TABLE(voltage_attrs) },
+};
+
+/* Registers "reg0000" and up, then sample_rate; filled by main() */
+static char reg_names[BENCH_TABLE_ATTRS][8];
+static struct tinyiiod_attr_desc table_attrs[BENCH_TABLE_ATTRS + 1];
+
+static const struct tinyiiod_device_desc table_devices[] = {
+	{
+		"0", "adc", TINYIIOD_TABLE(table_channels),
+		{ TINYIIOD_TABLE(table_attrs), { NULL, 0 }, { NULL, 0 } },
+	},
+};
+
+static const struct tinyiiod_context_desc table_context = {
+	"bench", "tinyiiod benchmark", TINYIIOD_TABLE(table_devices),
+};
+
+static struct tinyiiod_ops_priv ops = {
+	.read = bench_read,
+	.write = bench_write,
+	.read_avail = bench_read_avail,
+	.read_ready = bench_read_ready,
+	.writev = bench_writev,
+
+	.read_attr = read_attr,
+	.write_attr = write_attr,
+	.ch_read_attr = ch_read_attr,
+	.ch_write_attr = ch_write_attr,
+	.open = open_buffer,
+	.close = close_buffer,
+	.get_mask = get_mask,
+	.transfer_dev_to_mem = transfer_dev_to_mem,
+	.read_data = read_data,
+	.transfer_mem_to_dev = transfer_mem_to_dev,
+	.write_data = write_data,
+	.rearm = rearm,
+	.get_xml = get_xml,
+	.release_xml = release_xml,
+};
+
+/* Variants of the backend, set up by main() */
+static struct tinyiiod_ops_priv zerocopy_ops, static_ops, chunk_ops,
+			       cache_ops, async_ops, unbuffered_ops,
+			       pipeline_ops, wide_ops, scans_ops,
+			       scans_pipeline_ops;
+
+static struct reply reply(enum reply_kind kind, int32_t value,
+			  size_t mask_words)
+{
+	struct reply r = { kind, value, mask_words, false };
+
+	return r;
+}
+
+static void script_expect(struct script *s, struct reply r, bool binary)
+{
+	if (s->commands == s->replies_size) {
+		s->replies_size = s->replies_size ? s->replies_size * 2 : 256;
+		s->replies = xrealloc(s->replies,
+				      s->replies_size * sizeof(*s->replies));
+	}
+
+	r.binary = binary;
+	s->replies[s->commands++] = r;
+}
+
+/* Append a text command, and the reply it should get */
+static void script_printf(struct script *s, struct reply r,
+			  const char *fmt, ...)
+{
+	char line[128];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	buffer_append(&s->data, line, (size_t) len);
+	script_expect(s, r, false);
+}
+
+static void script_frame(struct script *s, struct reply r,
+			 enum tinyiiod_opcode op, unsigned char flags,
+			 int32_t code, const char *args, size_t len)
+{
+	unsigned char hdr[TINYIIOD_BINARY_HEADER_SIZE] = {
+		(unsigned char) op, 0, flags, 0,
+		(unsigned char) len, (unsigned char) (len >> 8),
+		(unsigned char) (len >> 16), (unsigned char) (len >> 24),
+		(unsigned char) code, (unsigned char) (code >> 8),
+		(unsigned char) (code >> 16), (unsigned char) (code >> 24),
+	};
+
+	buffer_append(&s->data, hdr, sizeof(hdr));
+	buffer_append(&s->data, args, len);
+	script_expect(s, r, true);
+}
+
+static void script_payload(struct script *s, size_t len)
+{
+	for (; len > sizeof(samples); len -= sizeof(samples))
+		buffer_append(&s->data, samples, sizeof(samples));
+	buffer_append(&s->data, samples, len);
+}
+
+/* The last command started a stream: let it push blocks blocks of size
+ * bytes before the client sends anything else */
+static void script_pause(struct script *s, size_t size, unsigned int blocks)
+{
+	struct pause *p = &s->pauses[s->nb_pauses++];
+
+	p->offset = s->data.len;
+	p->size = size;
+	p->blocks = blocks;
+	s->blocks += blocks;
+}
+
+static void build_attr_poll(struct script *s, size_t size, unsigned int count)
+{
+	while (count--)
+		script_printf(s, DATA(3), "READ adc INPUT voltage0 raw\r\n");
+}
+
+/* All the attributes of the channel in one command: two values of
+ * 3 bytes, each after its length and padded to 4 bytes */
+static void build_attr_poll_all(struct script *s, size_t size,
+				unsigned int count)
+{
+	while (count--)
+		script_printf(s, DATA(16), "READ adc INPUT voltage0 \r\n");
+}
+
+static void build_attr_poll_binary(struct script *s, size_t size,
+				   unsigned int count)
+{
+	static const char args[] = "adc\0voltage0\0raw";
+
+	script_printf(s, STATUS(0), "BINARY\r\n");
+
+	while (count--)
+		script_frame(s, DATA(3), TINYIIOD_OP_READ,
+			     TINYIIOD_FLAG_CHANNEL, 0, args, sizeof(args));
+
+	/* Back to text, for the script to be run again */
+	script_frame(s, STATUS(0), TINYIIOD_OP_TEXT, 0, 0, "", 0);
+}
+
+static void build_attr_poll_table(struct script *s, size_t size,
+				  unsigned int count);
+
+#ifdef TINYIIOD_STATS
+static void build_stats_poll(struct script *s, size_t size,
+			     unsigned int count)
+{
+	while (count--)
+		script_printf(s, DATA(-1), "READ adc DEBUG %s\r\n",
+			      TINYIIOD_STATS_ATTR);
+}
+#endif
+
+static void build_attr_write(struct script *s, size_t size,
+			     unsigned int count)
+{
+	while (count--)
+		script_printf(s, STATUS(4), "WRITE adc sample_rate 4\r\n1000");
+}
+
+/* What a client session sends, the sample reads aside */
+static void build_command_mix(struct script *s, size_t size,
+			      unsigned int count)
+{
+	script_printf(s, STATUS(0), "OPEN adc %zu 00000003\r\n", size / 4);
+
+	while (count--) {
+		switch (count % 8) {
+		case 0:
+			script_printf(s, LINE, "VERSION\r\n");
+			break;
+		case 1:
+			script_printf(s, STATUS(0), "TIMEOUT 1000\r\n");
+			break;
+		case 2:
+			script_printf(s, DATA(4), "READ adc sample_rate\r\n");
+			break;
+		case 3:
+			script_printf(s, STATUS(4),
+				      "WRITE adc sample_rate 4\r\n1000");
+			break;
+		case 4:
+			script_printf(s, DATA(3),
+				      "READ adc INPUT voltage1 scale\r\n");
+			break;
+		case 5:
+			script_printf(s, STATUS(3),
+				      "WRITE adc INPUT voltage1 raw 3\r\n256");
+			break;
+		case 6:
+			script_printf(s, DATA(4),
+				      "READ adc DEBUG direct_reg_access\r\n");
+			break;
+		default:
+			script_printf(s, SAMPLES(size, 1),
+				      "READBUF adc %zu\r\n", size);
+			break;
+		}
+	}
+
+	script_printf(s, STATUS(0), "CLOSE adc\r\n");
+}
+
+static void build_print(struct script *s, size_t size, unsigned int count)
+{
+	while (count--)
+		script_printf(s, DATA(strlen(xml)), "PRINT\r\n");
+}
+
+static void build_zprint(struct script *s, size_t size, unsigned int count)
+{
+	while (count--)
+		script_printf(s, ZDATA(strlen(xml)), "ZPRINT\r\n");
+}
+
+/* XML generated from the context description */
+static void build_print_table(struct script *s, size_t size,
+			      unsigned int count)
+{
+	while (count--)
+		script_printf(s, DATA(-1), "PRINT\r\n");
+}
+
+static void build_readbuf(struct script *s, size_t size, unsigned int count)
+{
+	script_printf(s, STATUS(0), "OPEN adc %zu 00000003\r\n", size / 4);
+
+	while (count--)
+		script_printf(s, SAMPLES(size, 1), "READBUF adc %zu\r\n", size);
+
+	script_printf(s, STATUS(0), "CLOSE adc\r\n");
+}
+
+/* Blocks captured while the previous ones are sent */
+static void build_readbuf_pipelined(struct script *s, size_t size,
+				    unsigned int count)
+{
+	script_printf(s, STATUS(0), "SET adc BUFFERS_COUNT 4\r\n");
+	build_readbuf(s, size, count);
+}
+
+/* Only voltage0 of the ADC capturing both channels */
+static void build_readbuf_packed(struct script *s, size_t size,
+				 unsigned int count)
+{
+	script_printf(s, STATUS(0), "OPEN adc %zu 00000001\r\n", size / 2);
+
+	while (count--)
+		script_printf(s, SAMPLES(size, 1), "READBUF adc %zu\r\n", size);
+
+	script_printf(s, STATUS(0), "CLOSE adc\r\n");
+}
+
+static void build_readbuf_packed_pipelined(struct script *s, size_t size,
+					   unsigned int count)
+{
+	script_printf(s, STATUS(0), "SET adc BUFFERS_COUNT 4\r\n");
+	build_readbuf_packed(s, size, count);
+}
+
+static void build_readbuf_wide(struct script *s, size_t size,
+			       unsigned int count)
+{
+	script_printf(s, STATUS(0), "OPEN adc %zu 0000000100000003\r\n",
+		      size / 6);
+
+	while (count--)
+		script_printf(s, SAMPLES(size, 2), "READBUF adc %zu\r\n", size);
+
+	script_printf(s, STATUS(0), "CLOSE adc\r\n");
+}
+
+static void build_readbuf_binary(struct script *s, size_t size,
+				 unsigned int count)
+{
+	static const char open_args[] = "adc\0\x03\0\0";
+
+	script_printf(s, STATUS(0), "BINARY\r\n");
+	script_frame(s, STATUS(0), TINYIIOD_OP_OPEN, 0, (int32_t) (size / 4),
+		     open_args, sizeof(open_args));
+
+	while (count--)
+		script_frame(s, SAMPLES(size, 1), TINYIIOD_OP_READBUF, 0,
+			     (int32_t) size, "adc", sizeof("adc"));
+
+	script_frame(s, STATUS(0), TINYIIOD_OP_CLOSE, 0, 0,
+		     "adc", sizeof("adc"));
+	script_frame(s, STATUS(0), TINYIIOD_OP_TEXT, 0, 0, "", 0);
+}
+
+/* One STREAM command, then count blocks pushed without being asked */
+static void build_stream(struct script *s, size_t size, unsigned int count)
+{
+	script_printf(s, reply(REPLY_STREAM, (int32_t) size, 1),
+		      "STREAM adc %zu\r\n", size);
+	script_pause(s, size, count);
+	script_printf(s, STATUS(0), "STOP adc\r\n");
+}
+
+static void build_stream_binary(struct script *s, size_t size,
+				unsigned int count)
+{
+	script_printf(s, STATUS(0), "BINARY\r\n");
+	script_frame(s, reply(REPLY_STREAM, (int32_t) size, 1),
+		     TINYIIOD_OP_STREAM, 0, (int32_t) size,
+		     "adc", sizeof("adc"));
+	script_pause(s, size, count);
+	script_frame(s, STATUS(0), TINYIIOD_OP_STOP, 0, 0,
+		     "adc", sizeof("adc"));
+	script_frame(s, STATUS(0), TINYIIOD_OP_TEXT, 0, 0, "", 0);
+}
+
+static void build_writebuf(struct script *s, size_t size, unsigned int count)
+{
+	script_printf(s, STATUS(0), "OPEN dac %zu 00000001\r\n", size / 2);
+
+	while (count--) {
+		script_printf(s, WRITEBUF(size), "WRITEBUF dac %zu\r\n", size);
+		script_payload(s, size);
+	}
+
+	script_printf(s, STATUS(0), "CLOSE dac\r\n");
+}
+
+static void build_writebuf_binary(struct script *s, size_t size,
+				  unsigned int count)
+{
+	static const char open_args[] = "dac\0\x01\0\0";
+
+	script_printf(s, STATUS(0), "BINARY\r\n");
+	script_frame(s, STATUS(0), TINYIIOD_OP_OPEN, 0, (int32_t) (size / 2),
+		     open_args, sizeof(open_args));
+
+	while (count--) {
+		script_frame(s, WRITEBUF(size), TINYIIOD_OP_WRITEBUF, 0,
+			     (int32_t) size, "dac", sizeof("dac"));
+		script_payload(s, size);
+	}
+
+	script_frame(s, STATUS(0), TINYIIOD_OP_CLOSE, 0, 0,
+		     "dac", sizeof("dac"));
+	script_frame(s, STATUS(0), TINYIIOD_OP_TEXT, 0, 0, "", 0);
+}
+
+static void build_attr_read_large(struct script *s, size_t size,
+				  unsigned int count)
+{
+	while (count--)
+		script_printf(s, DATA(sizeof(samples)),
+			      "READ dac fir_coeffs\r\n");
+}
+
+static void build_attr_write_large(struct script *s, size_t size,
+				   unsigned int count)
+{
+	while (count--) {
+		script_printf(s, STATUS(size), "WRITE dac fir_coeffs %zu\r\n",
+			      size);
+		script_payload(s, size);
+	}
+}
+
+/* Registers all over a big table */
+static void build_attr_poll_table(struct script *s, size_t size,
+				  unsigned int count)
+{
+	while (count--)
+		script_printf(s, DATA(4), "READ adc reg%04u\r\n",
+			      count * 7 % BENCH_TABLE_ATTRS);
+}
+
+/* Cyclic waveform reopened and restarted without sending it again */
+static void build_rearm(struct script *s, size_t size, unsigned int count)
+{
+	script_printf(s, STATUS(0), "OPEN dac %zu 00000001 CYCLIC\r\n",
+		      size / 2);
+	script_printf(s, WRITEBUF(size), "WRITEBUF dac %zu\r\n", size);
+	script_payload(s, size);
+	script_printf(s, STATUS(0), "CLOSE dac\r\n");
+
+	while (count--) {
+		script_printf(s, STATUS(0), "OPEN dac %zu 00000001 CYCLIC\r\n",
+			      size / 2);
+		script_printf(s, STATUS(size), "REARM dac\r\n");
+		script_printf(s, STATUS(0), "CLOSE dac\r\n");
+	}
+}
+
+struct workload {
+	const char *name;
+	void (*build)(struct script *s, size_t size, unsigned int count);
+	size_t size;
+
+	/* One instance per run of the script, like a client connecting */
+	bool connect;
+
+	/* Backend, if not the default one */
+	struct tinyiiod_ops_priv *ops;
+
+	/* Set up with tinyiiod_init() in static memory, with these sizes */
+	const struct tinyiiod_config *config;
+
+	/* Context description, instead of the XML and the attribute ops */
+	const struct tinyiiod_context_desc *ctx;
+
+	/* Instances sharing the commands, each running a part of them */
+	unsigned int clients;
+
+	/* Serial link whose transfer time is added to the measure */
+	unsigned int baud;
+};
+
+static const struct tinyiiod_config default_config;
+
+/* Small MCU: a few hundred bytes of buffers */
+static const struct tinyiiod_config small_config = {
+	.buffer_size = 256,
+	.rx_size = 64,
+	.tx_size = 128,
+};
+
+/* Much less room than what follows a parked transfer in one
+ * tinyiiod_feed() call: the rest is fed again after the transfer */
+static const struct tinyiiod_config async_config = {
+	.rx_size = 64,
+};
+
+/* Room for the compressed XML of ZPRINT, or the generated one of the
+ * register map, about 30 KiB */
+static const struct tinyiiod_config xml_config = {
+	.xml_size = 32768,
+};
+
+/* Sizes of the buffer the samples go through */
+static const struct tinyiiod_config buffer_configs[] = {
+	{ .buffer_size = 256 },
+	{ .buffer_size = 1024 },
+	{ .buffer_size = 4096 },
+	{ .buffer_size = 16384 },
+};
+
+static const struct workload workloads[] = {
+	{ .name = "attr_poll", .build = build_attr_poll },
+	{ .name = "attr_poll_all", .build = build_attr_poll_all },
+	{ .name = "attr_poll_binary", .build = build_attr_poll_binary },
+	{ .name = "attr_poll_cached", .build = build_attr_poll,
+	  .ops = &cache_ops },
+	{ .name = "attr_poll_table", .build = build_attr_poll_table,
+	  .ctx = &table_context },
+	/* Commands received one byte per read() call */
+	{ .name = "attr_poll_unbuffered", .build = build_attr_poll,
+	  .ops = &unbuffered_ops },
+	{ .name = "attr_poll_clients", .build = build_attr_poll,
+	  .clients = 64 },
+	{ .name = "attr_write", .build = build_attr_write },
+	{ .name = "command_mix", .build = build_command_mix, .size = 4096 },
+#ifdef TINYIIOD_STATS
+	{ .name = "stats_poll", .build = build_stats_poll },
+#endif
+	{ .name = "print_connect", .build = build_print, .connect = true },
+	{ .name = "zprint_connect", .build = build_zprint, .connect = true },
+	{ .name = "print_uart", .build = build_print, .connect = true,
+	  .baud = BENCH_UART_BAUD },
+	{ .name = "zprint_uart", .build = build_zprint, .connect = true,
+	  .baud = BENCH_UART_BAUD },
+	{ .name = "readbuf", .build = build_readbuf, .size = 64 },
+	{ .name = "readbuf", .build = build_readbuf, .size = 4096 },
+	{ .name = "readbuf", .build = build_readbuf, .size = 65536 },
+	{ .name = "readbuf_binary", .build = build_readbuf_binary,
+	  .size = 4096 },
+	{ .name = "readbuf_binary", .build = build_readbuf_binary,
+	  .size = 65536 },
+	{ .name = "readbuf_pipelined", .build = build_readbuf_pipelined,
+	  .size = 4096, .ops = &pipeline_ops },
+	{ .name = "readbuf_pipelined", .build = build_readbuf_pipelined,
+	  .size = 65536, .ops = &pipeline_ops },
+	{ .name = "readbuf_packed", .build = build_readbuf_packed,
+	  .size = 4096, .ops = &scans_ops },
+	{ .name = "readbuf_packed_pipelined",
+	  .build = build_readbuf_packed_pipelined, .size = 4096,
+	  .ops = &scans_pipeline_ops },
+	{ .name = "readbuf_wide", .build = build_readbuf_wide, .size = 4096,
+	  .ops = &wide_ops },
+	{ .name = "readbuf_clients", .build = build_readbuf, .size = 4096,
+	  .clients = 16 },
+	{ .name = "stream", .build = build_stream, .size = 4096 },
+	{ .name = "stream_binary", .build = build_stream_binary,
+	  .size = 4096 },
+	{ .name = "writebuf", .build = build_writebuf, .size = 64 },
+	{ .name = "writebuf", .build = build_writebuf, .size = 4096 },
+	{ .name = "writebuf", .build = build_writebuf, .size = 65536 },
+	{ .name = "writebuf_binary", .build = build_writebuf_binary,
+	  .size = 4096 },
+	{ .name = "writebuf_zerocopy", .build = build_writebuf, .size = 4096,
+	  .ops = &zerocopy_ops },
+	{ .name = "writebuf_zerocopy", .build = build_writebuf, .size = 65536,
+	  .ops = &zerocopy_ops },
+	{ .name = "readbuf_async", .build = build_readbuf, .size = 4096,
+	  .ops = &async_ops, .config = &async_config },
+	{ .name = "writebuf_async", .build = build_writebuf, .size = 4096,
+	  .ops = &async_ops, .config = &async_config },
+	{ .name = "rearm", .build = build_rearm, .size = 65536 },
+	{ .name = "attr_read_large", .build = build_attr_read_large,
+	  .size = 65536, .ops = &chunk_ops },
+	{ .name = "attr_write_large", .build = build_attr_write_large,
+	  .size = 65536, .ops = &chunk_ops },
+	{ .name = "attr_poll_static", .build = build_attr_poll,
+	  .ops = &static_ops, .config = &small_config },
+	{ .name = "print_connect_static", .build = build_print,
+	  .connect = true, .ops = &static_ops, .config = &default_config },
+	{ .name = "zprint_connect_static", .build = build_zprint,
+	  .connect = true, .ops = &static_ops, .config = &xml_config },
+	{ .name = "print_table_static", .build = build_print_table,
+	  .connect = true, .ops = &static_ops, .config = &xml_config,
+	  .ctx = &table_context },
+	{ .name = "readbuf_static", .build = build_readbuf, .size = 4096,
+	  .ops = &static_ops, .config = &small_config },
+	{ .name = "writebuf_static", .build = build_writebuf, .size = 4096,
+	  .ops = &static_ops, .config = &small_config },
+	{ .name = "readbuf_buffer", .build = build_readbuf, .size = 65536,
+	  .ops = &static_ops, .config = &buffer_configs[0] },
+	{ .name = "readbuf_buffer", .build = build_readbuf, .size = 65536,
+	  .ops = &static_ops, .config = &buffer_configs[1] },
+	{ .name = "readbuf_buffer", .build = build_readbuf, .size = 65536,
+	  .ops = &static_ops, .config = &buffer_configs[2] },
+	{ .name = "readbuf_buffer", .build = build_readbuf, .size = 65536,
+	  .ops = &static_ops, .config = &buffer_configs[3] },
+	{ .name = "writebuf_buffer", .build = build_writebuf, .size = 65536,
+	  .ops = &static_ops, .config = &buffer_configs[0] },
+	{ .name = "writebuf_buffer", .build = build_writebuf, .size = 65536,
+	  .ops = &static_ops, .config = &buffer_configs[1] },
+	{ .name = "writebuf_buffer", .build = build_writebuf, .size = 65536,
+	  .ops = &static_ops, .config = &buffer_configs[2] },
+	{ .name = "writebuf_buffer", .build = build_writebuf, .size = 65536,
+	  .ops = &static_ops, .config = &buffer_configs[3] },
+};
+
+/* Responses being checked */
+struct cursor {
+	const char *buf;
+	size_t len, pos;
+};
+
+static uint32_t get_le32(const char *buf)
+{
+	const unsigned char *ptr = (const unsigned char *) buf;
+
+	return (uint32_t) ptr[0] | (uint32_t) ptr[1] << 8 |
+	       (uint32_t) ptr[2] << 16 | (uint32_t) ptr[3] << 24;
+}
+
+static int skip(struct cursor *c, size_t len)
+{
+	if (len > c->len - c->pos)
+		return -EBADMSG;
+
+	c->pos += len;
+
+	return 0;
+}
+
+/* Data is followed by a newline in text mode only */
+static int skip_eol(struct cursor *c, bool binary)
+{
+	if (binary)
+		return 0;
+
+	if (c->pos == c->len || c->buf[c->pos] != '\n')
+		return -EBADMSG;
+
+	c->pos++;
+
+	return 0;
+}
+
+static int skip_line(struct cursor *c)
+{
+	const char *eol = memchr(c->buf + c->pos, '\n', c->len - c->pos);
+
+	if (!eol)
+		return -EBADMSG;
+
+	c->pos = (size_t) (eol - c->buf) + 1;
+
+	return 0;
+}
+
+/* Status line, or binary header with op, of which *len gets the length */
+static int get_status(struct cursor *c, bool binary, enum tinyiiod_opcode op,
+		      int32_t *value, size_t *len)
+{
+	char line[16], *end;
+	size_t start = c->pos;
+
+	*len = 0;
+
+	if (binary) {
+		if (skip(c, TINYIIOD_BINARY_HEADER_SIZE) < 0 ||
+		    (unsigned char) c->buf[start] != op)
+			return -EBADMSG;
+
+		*len = get_le32(c->buf + start + 4);
+		*value = (int32_t) get_le32(c->buf + start + 8);
+
+		return 0;
+	}
+
+	if (skip_line(c) < 0 || c->pos - start > sizeof(line))
+		return -EBADMSG;
+
+	memcpy(line, c->buf + start, c->pos - start - 1);
+	line[c->pos - start - 1] = '\0';
+
+	*value = (int32_t) strtol(line, &end, 10);
+
+	return end == line || *end ? -EBADMSG : 0;
+}
+
+static int check_status(struct cursor *c, bool binary, int32_t expected)
+{
+	int32_t value;
+	size_t len;
+
+	if (get_status(c, binary, TINYIIOD_OP_RESPONSE, &value, &len) < 0 ||
+	    value != expected || len)
+		return -EBADMSG;
+
+	return 0;
+}
+
+/* Mask of READBUF and STREAM, after the first status */
+static int skip_mask(struct cursor *c, const struct reply *r)
+{
+	size_t len = r->mask_words * (r->binary ? 4 : 8);
+
+	if (skip(c, len) < 0)
+		return -EBADMSG;
+
+	return skip_eol(c, r->binary);
+}
+
+static int check_stream(struct cursor *c, const struct reply *r,
+			unsigned int blocks)
+{
+	int32_t value, seq;
+	unsigned int i;
+	size_t len;
+
+	if (get_status(c, r->binary, TINYIIOD_OP_RESPONSE, &value, &len) < 0 ||
+	    value || len != (r->binary ? r->mask_words * 4 : 0) ||
+	    skip_mask(c, r) < 0)
+		return -EBADMSG;
+
+	for (i = 0; i < blocks; i++) {
+		if (get_status(c, r->binary, TINYIIOD_OP_STREAM,
+			       &value, &len) < 0 || value != r->value)
+			return -EBADMSG;
+
+		if (r->binary) {
+			if (len != (size_t) value + 4 || skip(c, 4) < 0)
+				return -EBADMSG;
+			seq = (int32_t) get_le32(c->buf + c->pos - 4);
+		} else if (get_status(c, false, 0, &seq, &len) < 0) {
+			return -EBADMSG;
+		}
+
+		if (seq != (int32_t) i || skip(c, (size_t) value) < 0)
+			return -EBADMSG;
+	}
+
+	return 0;
+}
+
+static int check_reply(struct cursor *c, const struct reply *r,
+		       unsigned int blocks)
+{
+	bool binary = r->binary;
+	int32_t value, zlen;
+	size_t len, total;
+
+	switch (r->kind) {
+	case REPLY_STATUS:
+		return check_status(c, binary, r->value);
+	case REPLY_LINE:
+		if (!binary)
+			return skip_line(c);
+
+		if (get_status(c, binary, TINYIIOD_OP_RESPONSE,
+			       &value, &len) < 0 || value)
+			return -EBADMSG;
+
+		return skip(c, len);
+	case REPLY_DATA:
+		if (get_status(c, binary, TINYIIOD_OP_RESPONSE,
+			       &value, &len) < 0 || value < 0 ||
+		    (r->value >= 0 && value != r->value) ||
+		    (binary && len != (size_t) value))
+			return -EBADMSG;
+
+		if (skip(c, (size_t) value) < 0)
+			return -EBADMSG;
+
+		return skip_eol(c, binary);
+	case REPLY_ZDATA:
+		if (get_status(c, binary, TINYIIOD_OP_RESPONSE,
+			       &zlen, &len) < 0)
+			return -EBADMSG;
+
+		if (binary) {
+			value = zlen;
+			zlen = (int32_t) len;
+		} else if (get_status(c, binary, TINYIIOD_OP_RESPONSE,
+				      &value, &len) < 0) {
+			return -EBADMSG;
+		}
+
+		if (value != r->value || zlen <= 0 ||
+		    skip(c, (size_t) zlen) < 0)
+			return -EBADMSG;
+
+		return skip_eol(c, binary);
+	case REPLY_SAMPLES:
+		for (total = 0; total < (size_t) r->value;
+		     total += (size_t) value) {
+			if (get_status(c, binary, TINYIIOD_OP_RESPONSE,
+				       &value, &len) < 0 || value <= 0)
+				return -EBADMSG;
+
+			/* The mask comes with the first block only */
+			if (!total) {
+				if (binary &&
+				    len != (size_t) value + r->mask_words * 4)
+					return -EBADMSG;
+				if (skip_mask(c, r) < 0)
+					return -EBADMSG;
+			} else if (binary && len != (size_t) value) {
+				return -EBADMSG;
+			}
+
+			if (skip(c, (size_t) value) < 0)
+				return -EBADMSG;
+		}
+
+		return total == (size_t) r->value ? 0 : -EBADMSG;
+	case REPLY_WRITEBUF:
+		if (check_status(c, binary, r->value) < 0)
+			return -EBADMSG;
+
+		return check_status(c, binary, r->value);
+	case REPLY_STREAM:
+		return check_stream(c, r, blocks);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Compare the responses to a run of the script with what was expected */
+static int check_replies(const struct workload *w, const struct script *s,
+			 const struct buffer *out)
+{
+	struct cursor c = { out->buf, out->len, 0 };
+	unsigned int i, pause = 0, blocks;
+	size_t start;
+
+	for (i = 0; i < s->commands; i++) {
+		blocks = 0;
+		if (s->replies[i].kind == REPLY_STREAM && pause < s->nb_pauses)
+			blocks = s->pauses[pause++].blocks;
+
+		start = c.pos;
+		if (check_reply(&c, &s->replies[i], blocks) < 0) {
+			fprintf(stderr, "%s: unexpected reply to command %u, "
+				"at byte %zu of the responses\n",
+				w->name, i, start);
+			return -EBADMSG;
+		}
+	}
+
+	if (c.pos != c.len) {
+		fprintf(stderr, "%s: %zu bytes after the last reply\n",
+			w->name, c.len - c.pos);
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/* Give the next chunk of the script to an instance, like a server would
+ * when its socket is readable. At a pause of the client, the stream is
+ * pushed instead. Returns what tinyiiod_feed() did. */
+static int32_t feed_chunk(struct tinyiiod *iiod, struct bench *b,
+			  size_t chunk)
+{
+	const struct buffer *in = &b->script->data;
+	const struct pause *p = next_pause(b);
+	size_t len = in->len - b->in_pos;
+	unsigned int i;
+	int32_t ret;
+
+	if (p && b->in_pos == p->offset) {
+		b->pause++;
+
+		for (i = 0; i < p->blocks; i++) {
+			ret = tinyiiod_stream_step(iiod);
+			if (ret != (int32_t) p->size)
+				return ret < 0 ? ret : -EIO;
+		}
+
+		return -EAGAIN;
+	}
+
+	if (len > chunk)
+		len = chunk;
+	if (p && len > p->offset - b->in_pos)
+		len = p->offset - b->in_pos;
+
+	ret = tinyiiod_feed(iiod, in->buf + b->in_pos, len);
+
+	/* A parked transfer left the rest of the chunk to us */
+	if (ret > 0 || ret == -ENOSPC) {
+		b->in_pos += ret > 0 ? (size_t) ret : 0;
+		ret = -EBUSY;
+	} else {
+		b->in_pos += len;
+	}
+
+	while (ret == -EBUSY)
+		ret = tinyiiod_transfer_done(iiod, (ssize_t) b->transfer);
+
+	return ret;
+}
+
+/* Run the script once on every instance, returns 0 when all of it was
+ * consumed and every call succeeded. Instances fed chunks take turns. */
+static int drive(struct tinyiiod **iiods, struct bench *b, unsigned int nb,
+		 const struct script *s, size_t chunk)
+{
+	unsigned int i, j, busy;
+	int32_t ret;
+
+	for (i = 0; i < nb; i++) {
+		b[i].script = s;
+		b[i].in_pos = 0;
+		b[i].pause = 0;
+		b[i].polls = 0;
+	}
+
+	if (!chunk) {
+		for (i = 0; i < nb; i++) {
+			for (j = 0; j < s->commands; j++) {
+				ret = tinyiiod_read_command(iiods[i]);
+				if (ret < 0)
+					return ret;
+			}
+
+			if (b[i].in_pos != s->data.len)
+				return -EIO;
+		}
+
+		return 0;
+	}
+
+	do {
+		busy = 0;
+
+		for (i = 0; i < nb; i++) {
+			if (b[i].in_pos == s->data.len)
+				continue;
+
+			ret = feed_chunk(iiods[i], &b[i], chunk);
+			if (ret < 0 && ret != -EAGAIN)
+				return ret;
+
+			/* Nothing may be left half done at the end */
+			if (b[i].in_pos == s->data.len && ret)
+				return ret < 0 ? ret : -EIO;
+
+			busy++;
+		}
+	} while (busy);
+
+	return 0;
+}
+
+/* Instance of the workload, in the static arena or on the heap */
+static struct tinyiiod *bench_create(const struct workload *w,
+				     struct bench *b)
+{
+	struct tinyiiod_ops_priv *backend = w->ops ? w->ops : &ops;
+	struct tinyiiod *iiod;
+
+	if (!w->config)
+		iiod = tinyiiod_create_priv(backend, b);
+	else
+		iiod = tinyiiod_init(arena,
+				     tinyiiod_mem_size(backend, w->config),
+				     backend, b, w->config);
+
+	if (iiod && w->ctx && tinyiiod_set_context(iiod, w->ctx) < 0) {
+		tinyiiod_destroy(iiod);
+		return NULL;
+	}
+
+	return iiod;
+}
+
+static void bench_destroy(struct tinyiiod **iiods, unsigned int nb)
+{
+	unsigned int i;
+
+	for (i = 0; i < nb; i++) {
+		if (iiods[i])
+			tinyiiod_destroy(iiods[i]);
+		iiods[i] = NULL;
+	}
+}
+
+/* Run the script once, on new instances if the workload connects */
+static int run_once(const struct workload *w, struct tinyiiod **iiods,
+		    struct bench *b, unsigned int nb,
+		    const struct script *s, size_t chunk)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; w->connect && i < nb; i++) {
+		iiods[i] = bench_create(w, &b[i]);
+		if (!iiods[i]) {
+			bench_destroy(iiods, i);
+			return -ENOMEM;
+		}
+	}
+
+	ret = drive(iiods, b, nb, s, chunk);
+
+	if (w->connect)
+		bench_destroy(iiods, nb);
+
+	return ret;
+}
+
+/* Run the script once with the responses recorded, and check them */
+static int check(const struct workload *w, struct tinyiiod **iiods,
+		 struct bench *b, unsigned int nb,
+		 const struct script *s, size_t chunk)
+{
+	struct buffer *out = calloc(nb, sizeof(*out));
+	unsigned int i;
+	int ret;
+
+	if (!out)
+		return -ENOMEM;
+
+	for (i = 0; i < nb; i++)
+		b[i].capture = &out[i];
+
+	ret = run_once(w, iiods, b, nb, s, chunk);
+
+	for (i = 0; i < nb; i++) {
+		if (!ret)
+			ret = check_replies(w, s, &out[i]);
+
+		free(out[i].buf);
+
+		/* Only the timed runs count */
+		b[i].capture = NULL;
+		b[i].callbacks = 0;
+		b[i].io_calls = 0;
+		b[i].own_allocs = 0;
+		b[i].out_bytes = 0;
+	}
+
+	free(out);
+
+	return ret;
+}
+
+/* Check that tinyiiod_mem_size() is the least static instances need */
+static int check_mem_size(const struct workload *w, size_t mem_size)
+{
+	struct bench b = { 0 };
+
+	if (mem_size > sizeof(arena)) {
+		fprintf(stderr, "%s: %zu bytes needed\n", w->name, mem_size);
+		return -ENOMEM;
+	}
+
+	if (tinyiiod_init(arena, mem_size - 1, w->ops, &b, w->config)) {
+		fprintf(stderr, "%s: set up with %zu bytes\n",
+			w->name, mem_size - 1);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int run(const struct workload *w, unsigned int count, size_t chunk,
+	       double min_seconds)
+{
+	struct script s = { 0 };
+	struct tinyiiod_ops_priv *backend = w->ops ? w->ops : &ops;
+	size_t mem_size = tinyiiod_mem_size(backend, w->config);
+	unsigned int i, nb = w->clients ? w->clients : 1;
+	unsigned long long commands, in_bytes, out_bytes = 0;
+	unsigned long callbacks = 0, io_calls = 0, own_allocs = 0;
+	unsigned int runs = 0, min_runs = 1;
+	unsigned long nb_allocs = 0;
+	struct tinyiiod **iiods;
+	double start, seconds;
+	struct bench *b;
+	int ret = 0;
+
+	if (w->size && count > BENCH_BYTES / w->size)
+		count = BENCH_BYTES / w->size ? BENCH_BYTES / w->size : 1;
+
+	/* The clients share the commands */
+	if (count > nb)
+		count /= nb;
+
+	if (w->config) {
+		ret = check_mem_size(w, mem_size);
+		if (ret < 0)
+			return ret;
+	}
+
+	b = calloc(nb, sizeof(*b));
+	iiods = calloc(nb, sizeof(*iiods));
+	if (!b || !iiods) {
+		free(b);
+		free(iiods);
+		return -ENOMEM;
+	}
+
+	if (w->connect) {
+		w->build(&s, w->size, 1);
+		min_runs = count;
+	} else {
+		w->build(&s, w->size, count);
+
+		for (i = 0; i < nb && !ret; i++) {
+			iiods[i] = bench_create(w, &b[i]);
+			if (!iiods[i])
+				ret = -ENOMEM;
+		}
+	}
+
+	if (!ret)
+		ret = check(w, iiods, b, nb, &s, chunk);
+
+#ifdef BENCH_COUNT_ALLOCS
+	nb_allocs = allocs;
+#endif
+	start = now();
+
+	/* Repeat the script until the run is long enough to be measured */
+	while (!ret) {
+		ret = run_once(w, iiods, b, nb, &s, chunk);
+		runs++;
+
+		seconds = now() - start;
+		if (runs >= min_runs && seconds >= min_seconds)
+			break;
+	}
+
+	for (i = 0; i < nb; i++) {
+		callbacks += b[i].callbacks;
+		io_calls += b[i].io_calls;
+		own_allocs += b[i].own_allocs;
+		out_bytes += b[i].out_bytes;
+	}
+
+#ifdef BENCH_COUNT_ALLOCS
+	nb_allocs = allocs - nb_allocs - own_allocs;
+
+	/* Static instances must stay off the heap */
+	if (w->config && nb_allocs && !ret) {
+		fprintf(stderr, "%s: %lu allocations\n", w->name, nb_allocs);
+		ret = -EINVAL;
+	}
+#endif
+
+	bench_destroy(iiods, nb);
+	free(iiods);
+	free(b);
+
+	commands = (unsigned long long) (s.commands + s.blocks) * runs * nb;
+	in_bytes = (unsigned long long) s.data.len * runs * nb;
+	free(s.data.buf);
+	free(s.replies);
+
+	if (ret < 0) {
+		fprintf(stderr, "%s: error %d\n", w->name, ret);
+		return ret;
+	}
+
+	/* Start and stop bits included */
+	if (w->baud)
+		seconds += (double) (in_bytes + out_bytes) * 10 / w->baud;
+
+	printf("{\"workload\":\"%s\",\"transport\":\"%s\",\"size\":%zu,"
+	       "\"buffer_size\":%zu,\"clients\":%u,\"baud\":%u,"
+	       "\"commands\":%llu,\"seconds\":%.6f,\"commands_per_sec\":%.0f,"
+	       "\"mb_per_sec\":%.2f,\"callbacks_per_command\":%.3f,"
+	       "\"io_calls_per_command\":%.3f,\"mem_size\":%zu,",
+	       w->name, chunk ? "feed" : "read", w->size,
+	       w->config && w->config->buffer_size ?
+	       w->config->buffer_size : (size_t) IIOD_BUFFER_SIZE,
+	       nb, w->baud, commands, seconds, (double) commands / seconds,
+	       (double) (in_bytes + out_bytes) / 1e6 / seconds,
+	       (double) callbacks / commands,
+	       (double) io_calls / commands, mem_size);
+#ifdef BENCH_COUNT_ALLOCS
+	printf("\"allocs_per_command\":%.3f}\n",
+	       (double) nb_allocs / commands);
+#else
+	printf("\"allocs_per_command\":null}\n");
+#endif
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int count = BENCH_COMMANDS;
+	size_t i, chunk = BENCH_CHUNK;
+	double min_seconds = BENCH_SECONDS;
+	int opt, j, ret = 0;
+	bool selected;
+
+	while ((opt = getopt(argc, argv, "n:c:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = (unsigned int) strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			chunk = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			min_seconds = strtod(optarg, NULL);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n count] [-c chunk] "
+				"[-t seconds] [workload...]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!count || !chunk) {
+		fprintf(stderr, "count and chunk must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < sizeof(samples); i++)
+		samples[i] = (char) i;
+
+	zerocopy_ops = ops;
+	zerocopy_ops.write_data = NULL;
+	zerocopy_ops.get_write_ptr = get_write_ptr;
+
+	static_ops = ops;
+	static_ops.get_xml = get_static_xml;
+	static_ops.release_xml = NULL;
+
+	chunk_ops = ops;
+	chunk_ops.read_attr_chunk = read_attr_chunk;
+	chunk_ops.write_attr_chunk = write_attr_chunk;
+
+	cache_ops = ops;
+	cache_ops.get_cache_policy = get_cache_policy;
+
+	async_ops = ops;
+	async_ops.start_dev_to_mem = start_transfer;
+	async_ops.start_mem_to_dev = start_transfer;
+
+	unbuffered_ops = ops;
+	unbuffered_ops.read_avail = NULL;
+
+	pipeline_ops = ops;
+	pipeline_ops.submit_block = submit_block;
+	pipeline_ops.dequeue_block = dequeue_block;
+
+	wide_ops = ops;
+	wide_ops.open_mask = open_mask;
+	wide_ops.get_mask_words = get_mask_words;
+
+	scans_ops = ops;
+	scans_ops.read_data = NULL;
+	scans_ops.get_scans_ptr = get_scans_ptr;
+	scans_ops.get_mask = get_first_mask;
+
+	scans_pipeline_ops = scans_ops;
+	scans_pipeline_ops.submit_block = submit_block;
+	scans_pipeline_ops.dequeue_block = dequeue_block;
+
+	for (i = 0; i < BENCH_TABLE_ATTRS; i++) {
+		snprintf(reg_names[i], sizeof(reg_names[i]), "reg%04u",
+			 (unsigned int) i);
+		table_attrs[i].name = reg_names[i];
+		table_attrs[i].read = read_table_attr;
+		table_attrs[i].write = write_table_attr;
+	}
+	table_attrs[i].name = "sample_rate";
+	table_attrs[i].read = read_table_attr;
+	table_attrs[i].write = write_table_attr;
+
+	for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		selected = optind == argc;
+		for (j = optind; j < argc; j++)
+			selected |= !strcmp(argv[j], workloads[i].name);
+		if (!selected)
+			continue;
+
+		/* Blocking reads first, then the non-blocking parser */
+		if (run(&workloads[i], count, 0, min_seconds) < 0 ||
+		    run(&workloads[i], count, chunk, min_seconds) < 0)
+			ret = EXIT_FAILURE;
+	}
+
+	return ret;
+}
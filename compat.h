@@ -54,9 +54,13 @@ typedef int bool;
 
 #define ENOENT		2	/* No such file or directory */
 #define EIO		5	/* I/O error */
+#define ENOMEM		12	/* Out of memory */
+#define EBUSY		16	/* Device or resource busy */
 #define ENODEV		19	/* No such device */
 #define EINVAL		22	/* Invalid argument */
+#define ENOSPC		28	/* No space left on device */
 #define ENOSYS		38	/* Function not implemented */
+#define EINPROGRESS	115	/* Operation now in progress */
 
 #define PRIi32		"li"
 # define PRIx32		"x"
@@ -0,0 +1,301 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Round-trips varied inputs through tinyiiod_compress() and a reference
+ * decoder of the LZ4 block format written from the specification, which
+ * also enforces the end-of-block rules LZ4_decompress_safe() relies on.
+ */
+
+#include "tinyiiod-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_INPUT	(3 * 65536)
+
+#define LZ4_MIN_MATCH		4
+#define LZ4_LAST_LITERALS	5
+#define LZ4_MF_LIMIT		12
+
+static uint32_t seed = 1;
+
+static uint32_t rand32(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+static int read_length(const unsigned char **ip, const unsigned char *iend,
+		       size_t *len)
+{
+	unsigned char byte;
+
+	do {
+		if (*ip == iend)
+			return -1;
+		byte = *(*ip)++;
+		*len += byte;
+	} while (byte == 255);
+
+	return 0;
+}
+
+/* Returns the decoded size, or -1 with the reason on a malformed block */
+static long lz4_decode(const unsigned char *src, size_t len,
+		       unsigned char *dst, size_t dst_len, const char **err)
+{
+	const unsigned char *ip = src, *iend = src + len;
+	unsigned char *op = dst, *oend = dst + dst_len;
+	size_t nb_literals, match_len, offset;
+	unsigned char token;
+
+	for (;;) {
+		if (ip == iend) {
+			*err = "missing last sequence";
+			return -1;
+		}
+
+		token = *ip++;
+		nb_literals = token >> 4;
+		if (nb_literals == 15 && read_length(&ip, iend, &nb_literals)) {
+			*err = "truncated literal length";
+			return -1;
+		}
+
+		if (nb_literals > (size_t) (iend - ip) ||
+		    nb_literals > (size_t) (oend - op)) {
+			*err = "literals out of bounds";
+			return -1;
+		}
+
+		memcpy(op, ip, nb_literals);
+		ip += nb_literals;
+		op += nb_literals;
+
+		/* Only the last sequence ends right after its literals */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2) {
+			*err = "truncated offset";
+			return -1;
+		}
+
+		offset = ip[0] | (size_t) ip[1] << 8;
+		ip += 2;
+		if (!offset || offset > (size_t) (op - dst)) {
+			*err = "offset out of bounds";
+			return -1;
+		}
+
+		if ((size_t) (oend - op) < LZ4_MF_LIMIT) {
+			*err = "match starts in the last 12 bytes";
+			return -1;
+		}
+
+		match_len = token & 15;
+		if (match_len == 15 && read_length(&ip, iend, &match_len)) {
+			*err = "truncated match length";
+			return -1;
+		}
+		match_len += LZ4_MIN_MATCH;
+
+		if (match_len > (size_t) (oend - op) - LZ4_LAST_LITERALS) {
+			*err = "match runs into the last 5 bytes";
+			return -1;
+		}
+
+		/* Byte by byte, as the match may overlap what it copies */
+		for (; match_len; match_len--, op++)
+			*op = *(op - offset);
+	}
+
+	if (token & 15) {
+		*err = "match length in the last sequence";
+		return -1;
+	}
+
+	return (long) (op - dst);
+}
+
+static unsigned char input[MAX_INPUT];
+static unsigned char output[MAX_INPUT + 1];
+static char compressed[MAX_INPUT + MAX_INPUT / 255 + 16];
+
+/* Reused from one input to the next, as by static instances */
+static uint32_t table[TINYIIOD_LZ_TABLE_SIZE / sizeof(uint32_t)];
+
+static int check(const char *name, size_t len)
+{
+	const char *err = "wrong size";
+	ssize_t ret;
+	long size;
+
+	ret = tinyiiod_compress((const char *) input, len, compressed,
+				tinyiiod_compress_bound(len), table);
+	if (ret < 0) {
+		fprintf(stderr, "%s (%u bytes): compression failed: %d\n",
+			name, (unsigned int) len, (int) ret);
+		return -1;
+	}
+
+	/* One byte past the output is poisoned to catch an overrun */
+	memset(output, 0xa5, len + 1);
+
+	size = lz4_decode((const unsigned char *) compressed, (size_t) ret,
+			  output, len, &err);
+	if (size != (long) len || output[len] != 0xa5) {
+		fprintf(stderr, "%s (%u bytes): %s\n",
+			name, (unsigned int) len, err);
+		return -1;
+	}
+
+	if (memcmp(input, output, len)) {
+		fprintf(stderr, "%s (%u bytes): decoded data differs\n",
+			name, (unsigned int) len);
+		return -1;
+	}
+
+	/* Too small a destination is reported, not overrun */
+	if (ret > 0 && tinyiiod_compress((const char *) input, len,
+					 compressed, (size_t) ret - 1, NULL) !=
+	    -ENOSPC) {
+		fprintf(stderr, "%s (%u bytes): no -ENOSPC with %u bytes\n",
+			name, (unsigned int) len, (unsigned int) ret - 1);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void fill_random(size_t from, size_t to)
+{
+	size_t i;
+
+	for (i = from; i < to; i++)
+		input[i] = (unsigned char) rand32();
+}
+
+static void fill_pattern(size_t from, size_t to, size_t period)
+{
+	size_t i;
+
+	for (i = from; i < to; i++)
+		input[i] = (unsigned char) ('a' + i % period);
+}
+
+static void fill_xml(size_t len)
+{
+	size_t pos = 0;
+	int n;
+
+	while (pos < len) {
+		n = snprintf((char *) input + pos, len - pos + 1,
+			     "<channel id=\"voltage%u\" type=\"input\" >"
+			     "<attribute name=\"raw\" /></channel>",
+			     (unsigned int) (rand32() % 64));
+		pos += (size_t) n;
+	}
+}
+
+int main(void)
+{
+	static const size_t periods[] = { 1, 2, 3, 4, 7, 16, 255, 1000 };
+	unsigned int nb = 0, failed = 0;
+	size_t i, len, period;
+
+#define CHECK(name, len) do {					\
+		nb++;						\
+		if (check(name, len))				\
+			failed++;				\
+	} while (0)
+
+	CHECK("empty", 0);
+
+	/* Around the sizes where a match may start and must end */
+	for (len = 1; len <= 64; len++) {
+		fill_pattern(0, len, 1);
+		CHECK("single byte", len);
+		fill_pattern(0, len, 4);
+		CHECK("period 4", len);
+		fill_random(0, len);
+		CHECK("random", len);
+	}
+
+	/* Without any match: literal lengths on either side of 15 + 255 */
+	for (len = 250; len <= 300; len++) {
+		fill_random(0, len);
+		CHECK("random", len);
+	}
+	fill_random(0, MAX_INPUT);
+	CHECK("random", MAX_INPUT);
+
+	/* Long matches, with overlapping copies for the short periods */
+	for (i = 0; i < ARRAY_SIZE(periods); i++) {
+		period = periods[i];
+		for (len = 4000; len < 4010; len++) {
+			fill_pattern(0, len, period);
+			CHECK("pattern", len);
+		}
+		fill_pattern(0, MAX_INPUT, period);
+		CHECK("pattern", MAX_INPUT);
+	}
+
+	/* A match right before trailing literals of every short length */
+	for (len = 0; len <= 20; len++) {
+		fill_pattern(0, 100, 5);
+		fill_random(100, 100 + len);
+		CHECK("match then literals", 100 + len);
+	}
+
+	/* Many literals, then a match long enough for extra length bytes */
+	fill_random(0, 1000);
+	fill_pattern(1000, 2000, 1);
+	CHECK("literals then match", 2000);
+
+	/* A repeat farther back than the largest offset */
+	fill_random(0, 70000);
+	memcpy(input + 70000, input, 1000);
+	CHECK("distant repeat", 71000);
+
+	/* Repeats at the largest offset and just past it, with a run of
+	 * zeros in between so that the hash table still points at them */
+	for (len = 65535; len <= 65536; len++) {
+		fill_random(0, 64);
+		memset(input + 64, 0, len - 64);
+		memcpy(input + len, input, 64);
+		CHECK("repeat at the largest offset", len + 64);
+	}
+
+	for (len = 1; len < MAX_INPUT; len += 1 + rand32() % 10000) {
+		fill_xml(len);
+		CHECK("xml", len);
+	}
+
+	if (failed) {
+		fprintf(stderr, "%u of %u inputs failed\n", failed, nb);
+		return EXIT_FAILURE;
+	}
+
+	printf("%u inputs compressed and decoded back\n", nb);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+/*
+ * Minimal compressor producing the LZ4 block format, so that clients can
+ * decompress with a stock LZ4_decompress_safe(). It favours code size and
+ * a small memory footprint over compression ratio.
+ */
+
+#define LZ_MIN_MATCH		4
+#define LZ_LAST_LITERALS	5	/* The block must end with literals */
+#define LZ_MF_LIMIT		12	/* No match may start after this */
+#define LZ_MAX_OFFSET		65535
+
+static uint32_t lz_read32(const unsigned char *ptr)
+{
+	uint32_t val;
+
+	memcpy(&val, ptr, sizeof(val));
+	return val;
+}
+
+static uint32_t lz_hash(const unsigned char *ptr)
+{
+	return (uint32_t) (lz_read32(ptr) * 2654435761u) >>
+	       (32 - IIOD_LZ_HASH_BITS);
+}
+
+static unsigned char *lz_write_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char) len;
+
+	return op;
+}
+
+static unsigned char *lz_write_sequence(unsigned char *op,
+					const unsigned char *literals,
+					size_t nb_literals, size_t offset,
+					size_t match_len)
+{
+	unsigned char *token = op++;
+
+	if (nb_literals >= 15) {
+		*token = 15 << 4;
+		op = lz_write_length(op, nb_literals - 15);
+	} else {
+		*token = (unsigned char) (nb_literals << 4);
+	}
+
+	memcpy(op, literals, nb_literals);
+	op += nb_literals;
+
+	/* The last sequence only holds literals */
+	if (!match_len)
+		return op;
+
+	*op++ = (unsigned char) offset;
+	*op++ = (unsigned char) (offset >> 8);
+
+	match_len -= LZ_MIN_MATCH;
+	if (match_len >= 15) {
+		*token |= 15;
+		op = lz_write_length(op, match_len - 15);
+	} else {
+		*token |= (unsigned char) match_len;
+	}
+
+	return op;
+}
+
+/* Worst case size of a sequence: token, lengths, literals and offset */
+static size_t lz_sequence_bound(size_t nb_literals, size_t match_len)
+{
+	return 1 + nb_literals / 255 + 1 + nb_literals + 2 + match_len / 255 + 1;
+}
+
+size_t tinyiiod_compress_bound(size_t len)
+{
+	return len + len / 255 + 16;
+}
+
+/* table is TINYIIOD_LZ_TABLE_SIZE bytes of scratch memory, or NULL to
+ * have it allocated */
+ssize_t tinyiiod_compress(const char *src, size_t len,
+			  char *dst, size_t dst_len, uint32_t *table)
+{
+	const unsigned char *ip = (const unsigned char *) src;
+	const unsigned char *base = ip, *anchor = ip, *ref;
+	const unsigned char *iend = ip + len;
+	unsigned char *op = (unsigned char *) dst;
+	unsigned char *oend = op + dst_len;
+	uint32_t *alloc = NULL;
+	size_t match_len;
+	uint32_t h;
+
+	if (table) {
+		memset(table, 0, TINYIIOD_LZ_TABLE_SIZE);
+	} else {
+		table = alloc = calloc(1, TINYIIOD_LZ_TABLE_SIZE);
+		if (!table)
+			return -ENOMEM;
+	}
+
+	while (len >= LZ_MF_LIMIT && ip < iend - LZ_MF_LIMIT) {
+		h = lz_hash(ip);
+		ref = base + table[h];
+		table[h] = (uint32_t) (ip - base);
+
+		if (ref >= ip || ip - ref > LZ_MAX_OFFSET ||
+		    lz_read32(ref) != lz_read32(ip)) {
+			ip++;
+			continue;
+		}
+
+		match_len = LZ_MIN_MATCH;
+		while (ip + match_len < iend - LZ_LAST_LITERALS &&
+		       ip[match_len] == ref[match_len])
+			match_len++;
+
+		if (lz_sequence_bound((size_t) (ip - anchor), match_len) >
+		    (size_t) (oend - op))
+			goto err_nospc;
+
+		op = lz_write_sequence(op, anchor, (size_t) (ip - anchor),
+				       (size_t) (ip - ref), match_len);
+		ip += match_len;
+		anchor = ip;
+	}
+
+	if (lz_sequence_bound((size_t) (iend - anchor), 0) >
+	    (size_t) (oend - op))
+		goto err_nospc;
+
+	op = lz_write_sequence(op, anchor, (size_t) (iend - anchor), 0, 0);
+	free(alloc);
+
+	return (ssize_t) (op - (unsigned char *) dst);
+
+err_nospc:
+	free(alloc);
+	return -ENOSPC;
+}
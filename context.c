@@ -0,0 +1,328 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+/*
+ * Context described by static tables: the XML is generated from them, and
+ * the attributes are found with binary searches in the sorted tables.
+ */
+
+static const char xml_header[] =
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?><!DOCTYPE context [<!ELEMENT context "
+	"(device)*><!ELEMENT device (channel | attribute | debug-attribute | buffer-attribute)*><!ELEMENT "
+	"channel (scan-element?, attribute*)><!ELEMENT attribute EMPTY><!ELEMENT "
+	"scan-element EMPTY><!ELEMENT debug-attribute EMPTY><!ELEMENT buffer-attribute EMPTY><!ATTLIST context name "
+	"CDATA #REQUIRED description CDATA #IMPLIED><!ATTLIST device id CDATA "
+	"#REQUIRED name CDATA #IMPLIED><!ATTLIST channel id CDATA #REQUIRED type "
+	"(input|output) #REQUIRED name CDATA #IMPLIED><!ATTLIST scan-element index "
+	"CDATA #REQUIRED format CDATA #REQUIRED scale CDATA #IMPLIED><!ATTLIST "
+	"attribute name CDATA #REQUIRED filename CDATA #IMPLIED><!ATTLIST "
+	"debug-attribute name CDATA #REQUIRED><!ATTLIST buffer-attribute name "
+	"CDATA #REQUIRED value CDATA #IMPLIED>]>";
+
+static const char * const attr_tags[] = {
+	[IIO_ATTR_TYPE_DEVICE] = "attribute",
+	[IIO_ATTR_TYPE_DEBUG] = "debug-attribute",
+	[IIO_ATTR_TYPE_BUFFER] = "buffer-attribute",
+};
+
+/* XML being written: only counted once the buffer is full */
+struct xml_out {
+	char *buf;
+	size_t len, pos;
+};
+
+static void out_char(struct xml_out *out, char c)
+{
+	if (out->pos + 1 < out->len)
+		out->buf[out->pos] = c;
+	out->pos++;
+}
+
+static void out_str(struct xml_out *out, const char *str)
+{
+	while (*str)
+		out_char(out, *str++);
+}
+
+static void out_escaped(struct xml_out *out, const char *str)
+{
+	for (; *str; str++) {
+		switch (*str) {
+		case '&':
+			out_str(out, "&amp;");
+			break;
+		case '<':
+			out_str(out, "&lt;");
+			break;
+		case '>':
+			out_str(out, "&gt;");
+			break;
+		case '"':
+			out_str(out, "&quot;");
+			break;
+		default:
+			out_char(out, *str);
+			break;
+		}
+	}
+}
+
+/* Writes ' name="value"' */
+static void out_attr(struct xml_out *out, const char *name, const char *value)
+{
+	out_char(out, ' ');
+	out_str(out, name);
+	out_str(out, "=\"");
+	out_escaped(out, value);
+	out_char(out, '"');
+}
+
+static void out_attrs(struct xml_out *out, const struct tinyiiod_attr_table *t,
+		      const char *tag)
+{
+	size_t i;
+
+	for (i = 0; i < t->nb; i++) {
+		out_char(out, '<');
+		out_str(out, tag);
+		out_attr(out, "name", t->desc[i].name);
+		out_str(out, " />");
+	}
+}
+
+static void out_channel(struct xml_out *out,
+			const struct tinyiiod_channel_desc *chn)
+{
+	char index[24];
+
+	out_str(out, "<channel");
+	out_attr(out, "id", chn->id);
+	if (chn->name)
+		out_attr(out, "name", chn->name);
+	out_attr(out, "type", chn->output ? "output" : "input");
+	out_str(out, " >");
+
+	if (chn->format) {
+		snprintf(index, sizeof(index), "%ld", chn->index);
+		out_str(out, "<scan-element");
+		out_attr(out, "index", index);
+		out_attr(out, "format", chn->format);
+		out_str(out, " />");
+	}
+
+	out_attrs(out, &chn->attrs, "attribute");
+	out_str(out, "</channel>");
+}
+
+size_t tinyiiod_context_xml(const struct tinyiiod_context_desc *ctx,
+			    char *buf, size_t len)
+{
+	const struct tinyiiod_device_desc *dev;
+	struct xml_out out = { buf, len, 0 };
+	size_t i, j;
+
+	out_str(&out, xml_header);
+	out_str(&out, "<context");
+	out_attr(&out, "name", ctx->name);
+	if (ctx->description)
+		out_attr(&out, "description", ctx->description);
+	out_str(&out, " >");
+
+	for (i = 0; i < ctx->devices.nb; i++) {
+		dev = &ctx->devices.desc[i];
+
+		out_str(&out, "<device");
+		out_attr(&out, "id", dev->id);
+		if (dev->name)
+			out_attr(&out, "name", dev->name);
+		out_str(&out, " >");
+
+		for (j = 0; j < dev->channels.nb; j++)
+			out_channel(&out, &dev->channels.desc[j]);
+
+		for (j = 0; j < ARRAY_SIZE(attr_tags); j++)
+			out_attrs(&out, &dev->attrs[j], attr_tags[j]);
+
+		out_str(&out, "</device>");
+	}
+
+	out_str(&out, "</context>");
+
+	if (len)
+		buf[out.pos < len ? out.pos : len - 1] = '\0';
+
+	return out.pos;
+}
+
+static int compare_channels(const struct tinyiiod_channel_desc *a,
+			    const char *id, bool output)
+{
+	int ret = strcmp(a->id, id);
+
+	if (ret)
+		return ret;
+
+	return (int) a->output - (int) output;
+}
+
+static bool attrs_sorted(const struct tinyiiod_attr_table *t)
+{
+	size_t i;
+
+	for (i = 1; i < t->nb; i++)
+		if (strcmp(t->desc[i - 1].name, t->desc[i].name) >= 0)
+			return false;
+
+	return true;
+}
+
+static bool device_sorted(const struct tinyiiod_device_desc *dev)
+{
+	const struct tinyiiod_channel_desc *chn = dev->channels.desc;
+	size_t i;
+
+	for (i = 0; i < dev->channels.nb; i++) {
+		if (i && compare_channels(&chn[i - 1], chn[i].id,
+					  chn[i].output) >= 0)
+			return false;
+		if (!attrs_sorted(&chn[i].attrs))
+			return false;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(dev->attrs); i++)
+		if (!attrs_sorted(&dev->attrs[i]))
+			return false;
+
+	return true;
+}
+
+int32_t tinyiiod_set_context(struct tinyiiod *iiod,
+			     const struct tinyiiod_context_desc *ctx)
+{
+	const struct tinyiiod_device_desc *dev = ctx->devices.desc;
+	size_t i;
+
+	for (i = 0; i < ctx->devices.nb; i++) {
+		if (i && strcmp(dev[i - 1].id, dev[i].id) >= 0)
+			return -EINVAL;
+		if (!device_sorted(&dev[i]))
+			return -EINVAL;
+	}
+
+	iiod->ctx = ctx;
+	tinyiiod_invalidate_xml(iiod);
+	tinyiiod_invalidate_values(iiod);
+
+	return 0;
+}
+
+static const struct tinyiiod_device_desc *
+find_device(const struct tinyiiod_device_table *t, const char *device)
+{
+	size_t lo = 0, hi = t->nb, mid, i;
+	int ret;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ret = strcmp(t->desc[mid].id, device);
+		if (!ret)
+			return &t->desc[mid];
+		if (ret < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (i = 0; i < t->nb; i++)
+		if (t->desc[i].name && !strcmp(t->desc[i].name, device))
+			return &t->desc[i];
+
+	return NULL;
+}
+
+static const struct tinyiiod_channel_desc *
+find_channel(const struct tinyiiod_channel_table *t, const char *channel,
+	     bool output)
+{
+	size_t lo = 0, hi = t->nb, mid, i;
+	int ret;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ret = compare_channels(&t->desc[mid], channel, output);
+		if (!ret)
+			return &t->desc[mid];
+		if (ret < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (i = 0; i < t->nb; i++)
+		if (t->desc[i].name && t->desc[i].output == output &&
+		    !strcmp(t->desc[i].name, channel))
+			return &t->desc[i];
+
+	return NULL;
+}
+
+static const struct tinyiiod_attr_desc *
+find_attr(const struct tinyiiod_attr_table *t, const char *attr)
+{
+	size_t lo = 0, hi = t->nb, mid;
+	int ret;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ret = strcmp(t->desc[mid].name, attr);
+		if (!ret)
+			return &t->desc[mid];
+		if (ret < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+const struct tinyiiod_attr_desc *
+tinyiiod_context_attr(const struct tinyiiod_context_desc *ctx,
+		      const char *device, const char *channel, bool ch_out,
+		      const char *attr, enum iio_attr_type type)
+{
+	const struct tinyiiod_device_desc *dev;
+	const struct tinyiiod_channel_desc *chn;
+
+	dev = find_device(&ctx->devices, device);
+	if (!dev)
+		return NULL;
+
+	if (channel) {
+		chn = find_channel(&dev->channels, channel, ch_out);
+
+		return chn ? find_attr(&chn->attrs, attr) : NULL;
+	}
+
+	if ((unsigned int) type >= ARRAY_SIZE(dev->attrs))
+		return NULL;
+
+	return find_attr(&dev->attrs[type], attr);
+}
@@ -20,114 +20,86 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
-static ssize_t read_data(char *buf, size_t len)
+static ssize_t read_data(void *priv, char *buf, size_t len)
 {
-	return fread(buf, 1, len, stdin);
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = read(STDIN_FILENO, buf + done, len - done);
+		if (ret <= 0)
+			return done ? (ssize_t) done : -EIO;
+		done += ret;
+	}
+
+	return (ssize_t) done;
 }
 
-static ssize_t write_data(const char *buf, size_t len)
+static ssize_t read_avail(void *priv, char *buf, size_t len)
 {
-	return fwrite(buf, 1, len, stdout);
+	return read(STDIN_FILENO, buf, len);
 }
 
-static ssize_t read_attr(const char *device, const char *attr,
-			 char *buf, size_t len, enum iio_attr_type type)
+static ssize_t write_data(void *priv, const char *buf, size_t len)
 {
-	if (!strcmp(device, "adc") || !strcmp(device, "0")) {
-		switch (type) {
-		case IIO_ATTR_TYPE_DEVICE:
-			return (ssize_t) snprintf(buf, len, "1000");
-		case IIO_ATTR_TYPE_DEBUG:
-			return (ssize_t) snprintf(buf, len, "0");
-		case IIO_ATTR_TYPE_BUFFER:
-			return (ssize_t) snprintf(buf, len, "8");
-		default:
-			return -ENOENT;
-		}
-	}
-
-	return -ENOENT;
+	return fwrite(buf, 1, len, stdout);
 }
 
-static ssize_t write_attr(const char *device, const char *attr,
-			  const char *buf, size_t len, enum iio_attr_type type)
+/* Constant values, kept with the description of their attribute */
+static ssize_t read_const(void *priv, const struct tinyiiod_attr_desc *attr,
+			  char *buf, size_t len)
 {
-	return -ENOSYS;
+	return (ssize_t) snprintf(buf, len, "%s", (const char *) attr->data);
 }
 
-static ssize_t ch_read_attr(const char *device, const char *channel,
-			    bool ch_out, const char *attr, char *buf, size_t len)
-{
-	if (!strcmp(device, "adc") || !strcmp(device, "0")) {
-		if (ch_out)
-			return -ENOENT;
-
-		if (!strcmp(channel, "voltage0")) {
-			if (!strcmp(attr, "scale"))
-				return (ssize_t) snprintf(buf, len, "0.033");
-			else if (!strcmp(attr, "raw"))
-				return (ssize_t) snprintf(buf, len, "256");
-		} else if (!strcmp(channel, "voltage1")) {
-			if (!strcmp(attr, "scale"))
-				return (ssize_t) snprintf(buf, len, "0.033");
-			else if (!strcmp(attr, "raw"))
-				return (ssize_t) snprintf(buf, len, "128");
-		}
-	}
+static const struct tinyiiod_attr_desc voltage0_attrs[] = {
+	{ "raw", read_const, NULL, "256" },
+	{ "scale", read_const, NULL, "0.033" },
+};
 
-	return -ENOENT;
-}
+static const struct tinyiiod_attr_desc voltage1_attrs[] = {
+	{ "raw", read_const, NULL, "128" },
+	{ "scale", read_const, NULL, "0.033" },
+};
 
-static ssize_t ch_write_attr(const char *device, const char *channel,
-			     bool ch_out, const char *attr, const char *buf, size_t len)
-{
-	return -ENOSYS;
-}
+static const struct tinyiiod_channel_desc adc_channels[] = {
+	{ "voltage0", NULL, false, NULL, 0, TINYIIOD_TABLE(voltage0_attrs) },
+	{ "voltage1", NULL, false, NULL, 0, TINYIIOD_TABLE(voltage1_attrs) },
+};
 
-static const char * const xml =
-	"<?xml version=\"1.0\" encoding=\"utf-8\"?><!DOCTYPE context [<!ELEMENT context "
-	"(device)*><!ELEMENT device (channel | attribute | debug-attribute | buffer-attribute)*><!ELEMENT "
-	"channel (scan-element?, attribute*)><!ELEMENT attribute EMPTY><!ELEMENT "
-	"scan-element EMPTY><!ELEMENT debug-attribute EMPTY><!ELEMENT buffer-attribute EMPTY><!ATTLIST context name "
-	"CDATA #REQUIRED description CDATA #IMPLIED><!ATTLIST device id CDATA "
-	"#REQUIRED name CDATA #IMPLIED><!ATTLIST channel id CDATA #REQUIRED type "
-	"(input|output) #REQUIRED name CDATA #IMPLIED><!ATTLIST scan-element index "
-	"CDATA #REQUIRED format CDATA #REQUIRED scale CDATA #IMPLIED><!ATTLIST "
-	"attribute name CDATA #REQUIRED filename CDATA #IMPLIED><!ATTLIST "
-	"debug-attribute name CDATA #REQUIRED><!ATTLIST buffer-attribute name "
-	"CDATA #REQUIRED value CDATA #IMPLIED>]><context name=\"tiny\" "
-	"description=\"Tiny IIOD\" >"
-	"<device id=\"0\" name=\"adc\" >"
-	"<channel id=\"voltage0\" type=\"input\" >"
-	"<attribute name=\"scale\" /><attribute name=\"raw\" /></channel>"
-	"<channel id=\"voltage1\" type=\"input\" >"
-	"<attribute name=\"scale\" /><attribute name=\"raw\" /></channel>"
-	"<attribute name=\"sample_rate\" />"
-	"<debug-attribute name=\"direct_reg_access\" />"
-	"<buffer-attribute name=\"length_align_bytes\" />"
-	"</device></context>";
-
-static ssize_t get_xml(char **outxml)
-{
+static const struct tinyiiod_attr_desc adc_attrs[] = {
+	{ "sample_rate", read_const, NULL, "1000" },
+};
 
-	*outxml = calloc(1, strlen(xml) + 1);
-	if (!(*outxml))
-		return -ENOMEM;
-	memcpy(*outxml, xml, strlen(xml));
+static const struct tinyiiod_attr_desc adc_debug_attrs[] = {
+	{ "direct_reg_access", read_const, NULL, "0" },
+};
 
-	return 0;
-}
+static const struct tinyiiod_attr_desc adc_buffer_attrs[] = {
+	{ "length_align_bytes", read_const, NULL, "8" },
+};
 
-static struct tinyiiod_ops ops = {
+static const struct tinyiiod_device_desc devices[] = {
+	{
+		"0", "adc", TINYIIOD_TABLE(adc_channels),
+		{
+			TINYIIOD_TABLE(adc_attrs),
+			TINYIIOD_TABLE(adc_debug_attrs),
+			TINYIIOD_TABLE(adc_buffer_attrs),
+		},
+	},
+};
+
+static const struct tinyiiod_context_desc context = {
+	"tiny", "Tiny IIOD", TINYIIOD_TABLE(devices),
+};
+
+static struct tinyiiod_ops_priv ops = {
 	.read = read_data,
 	.write = write_data,
-
-	.read_attr = read_attr,
-	.write_attr = write_attr,
-	.ch_read_attr = ch_read_attr,
-	.ch_write_attr = ch_write_attr,
-	.get_xml = get_xml,
+	.read_avail = read_avail,
 };
 
 static bool stop;
@@ -147,7 +119,9 @@ static void quit_all(int32_t sig)
 
 int32_t main(void)
 {
-	struct tinyiiod *iiod = tinyiiod_create(&ops);
+	struct tinyiiod *iiod = tinyiiod_create_priv(&ops, NULL);
+
+	tinyiiod_set_context(iiod, &context);
 
 	set_handler(SIGHUP, &quit_all);
 	set_handler(SIGPIPE, &quit_all);
@@ -0,0 +1,206 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * A backend written for the original struct tinyiiod_ops, callbacks
+ * without priv, run through tinyiiod_create() and checked against the
+ * responses the protocol defines.
+ */
+
+#include "tinyiiod.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char script[] =
+	"READ adc sample_rate\r\n"
+	"READ adc INPUT voltage0 raw\r\n"
+	"WRITE adc sample_rate 4\r\n2000"
+	"READ adc sample_rate\r\n"
+	"PRINT\r\n"
+	"OPEN adc 4 00000001\r\n"
+	"READBUF adc 8\r\n"
+	"CLOSE adc\r\n"
+	"READ adc INPUT voltage9 raw\r\n";
+
+static const char xml[] =
+	"<context name=\"tiny\" ><device id=\"0\" name=\"adc\" >"
+	"<channel id=\"voltage0\" type=\"input\" >"
+	"<attribute name=\"raw\" /></channel>"
+	"<attribute name=\"sample_rate\" /></device></context>";
+
+static char sample_rate[16] = "1000";
+static bool opened;
+static size_t pos;
+static char out[1024];
+static size_t out_len;
+
+static ssize_t read_data(char *buf, size_t len)
+{
+	if (pos == sizeof(script) - 1)
+		return -EIO;
+
+	if (len > sizeof(script) - 1 - pos)
+		len = sizeof(script) - 1 - pos;
+
+	memcpy(buf, script + pos, len);
+	pos += len;
+
+	return (ssize_t) len;
+}
+
+static ssize_t write_data(const char *buf, size_t len)
+{
+	if (len > sizeof(out) - out_len)
+		return -ENOSPC;
+
+	memcpy(out + out_len, buf, len);
+	out_len += len;
+
+	return (ssize_t) len;
+}
+
+static ssize_t read_attr(const char *device, const char *attr,
+			 char *buf, size_t len, enum iio_attr_type type)
+{
+	if (strcmp(device, "adc") || strcmp(attr, "sample_rate"))
+		return -ENOENT;
+
+	return (ssize_t) snprintf(buf, len, "%s", sample_rate);
+}
+
+static ssize_t write_attr(const char *device, const char *attr,
+			  const char *buf, size_t len, enum iio_attr_type type)
+{
+	if (strcmp(device, "adc") || strcmp(attr, "sample_rate") ||
+	    len >= sizeof(sample_rate))
+		return -EINVAL;
+
+	memcpy(sample_rate, buf, len);
+	sample_rate[len] = '\0';
+
+	return (ssize_t) len;
+}
+
+static ssize_t ch_read_attr(const char *device, const char *channel,
+			    bool ch_out, const char *attr, char *buf, size_t len)
+{
+	if (strcmp(device, "adc") || strcmp(channel, "voltage0") || ch_out)
+		return -ENOENT;
+
+	return (ssize_t) snprintf(buf, len, "256");
+}
+
+static int32_t open_buffer(const char *device, size_t sample_size,
+			   uint32_t mask, bool cyclic)
+{
+	opened = true;
+
+	return mask == 1 ? 0 : -EINVAL;
+}
+
+static int32_t close_buffer(const char *device)
+{
+	opened = false;
+
+	return 0;
+}
+
+static int32_t get_mask(const char *device, uint32_t *mask)
+{
+	*mask = 1;
+
+	return 0;
+}
+
+static ssize_t transfer_dev_to_mem(const char *device, size_t bytes_count)
+{
+	return opened ? (ssize_t) bytes_count : -EBADF;
+}
+
+static ssize_t read_data_buf(const char *device, char *buf, size_t offset,
+			     size_t bytes_count)
+{
+	size_t i;
+
+	for (i = 0; i < bytes_count; i++)
+		buf[i] = (char) ('a' + offset + i);
+
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t get_xml(char **outxml)
+{
+	*outxml = (char *) xml;
+
+	return 0;
+}
+
+static struct tinyiiod_ops ops = {
+	.read = read_data,
+	.write = write_data,
+
+	.read_attr = read_attr,
+	.write_attr = write_attr,
+	.ch_read_attr = ch_read_attr,
+
+	.open = open_buffer,
+	.close = close_buffer,
+	.get_mask = get_mask,
+	.transfer_dev_to_mem = transfer_dev_to_mem,
+	.read_data = read_data_buf,
+	.get_xml = get_xml,
+};
+
+int main(void)
+{
+	char expected[1024];
+	struct tinyiiod *iiod;
+	int len;
+
+	len = snprintf(expected, sizeof(expected),
+		       "4\n1000\n"
+		       "3\n256\n"
+		       "4\n"
+		       "4\n2000\n"
+		       "%u\n%s\n"
+		       "0\n"
+		       "8\n00000001\nabcdefgh"
+		       "0\n"
+		       "%d\n",
+		       (unsigned int) strlen(xml), xml, -ENOENT);
+
+	iiod = tinyiiod_create(&ops);
+	if (!iiod)
+		return EXIT_FAILURE;
+
+	while (pos < sizeof(script) - 1)
+		tinyiiod_read_command(iiod);
+
+	tinyiiod_destroy(iiod);
+
+	if (out_len != (size_t) len || memcmp(out, expected, out_len)) {
+		fprintf(stderr, "Unexpected responses:\n%.*s",
+			(int) out_len, out);
+		return EXIT_FAILURE;
+	}
+
+	printf("Legacy backend served %u bytes of responses\n",
+	       (unsigned int) out_len);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,255 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+/*
+ * Backends written for struct tinyiiod_ops, whose callbacks have no priv
+ * argument. tinyiiod_create() gives the instance a struct tinyiiod_ops_priv
+ * of the wrappers below, with the legacy ops as priv; the ops the backend
+ * leaves NULL stay NULL, so that the optional ones are still detected.
+ */
+
+static ssize_t legacy_read(void *priv, char *buf, size_t len)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->read(buf, len);
+}
+
+static ssize_t legacy_write(void *priv, const char *buf, size_t len)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->write(buf, len);
+}
+
+static ssize_t legacy_read_line(void *priv, char *buf, size_t len)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->read_line(buf, len);
+}
+
+static ssize_t legacy_open_instance(void *priv)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->open_instance();
+}
+
+static ssize_t legacy_close_instance(void *priv)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->close_instance();
+}
+
+static ssize_t legacy_read_attr(void *priv, const char *device,
+				const char *attr, char *buf, size_t len,
+				enum iio_attr_type type)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->read_attr(device, attr, buf, len, type);
+}
+
+static ssize_t legacy_write_attr(void *priv, const char *device,
+				 const char *attr, const char *buf, size_t len,
+				 enum iio_attr_type type)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->write_attr(device, attr, buf, len, type);
+}
+
+static ssize_t legacy_ch_read_attr(void *priv, const char *device,
+				   const char *channel, bool ch_out,
+				   const char *attr, char *buf, size_t len)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->ch_read_attr(device, channel, ch_out, attr, buf, len);
+}
+
+static ssize_t legacy_ch_write_attr(void *priv, const char *device,
+				    const char *channel, bool ch_out,
+				    const char *attr, const char *buf,
+				    size_t len)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->ch_write_attr(device, channel, ch_out, attr, buf, len);
+}
+
+static int32_t legacy_open(void *priv, const char *device, size_t sample_size,
+			   uint32_t mask, bool cyclic)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->open(device, sample_size, mask, cyclic);
+}
+
+static int32_t legacy_close(void *priv, const char *device)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->close(device);
+}
+
+static ssize_t legacy_transfer_dev_to_mem(void *priv, const char *device,
+					  size_t bytes_count)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->transfer_dev_to_mem(device, bytes_count);
+}
+
+static ssize_t legacy_read_data(void *priv, const char *device, char *buf,
+				size_t offset, size_t bytes_count)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->read_data(device, buf, offset, bytes_count);
+}
+
+static ssize_t legacy_transfer_mem_to_dev(void *priv, const char *device,
+					  size_t bytes_count)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->transfer_mem_to_dev(device, bytes_count);
+}
+
+static ssize_t legacy_write_data(void *priv, const char *device,
+				 const char *buf, size_t offset,
+				 size_t bytes_count)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->write_data(device, buf, offset, bytes_count);
+}
+
+static int32_t legacy_get_mask(void *priv, const char *device, uint32_t *mask)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->get_mask(device, mask);
+}
+
+static int32_t legacy_get_trigger(void *priv, const char *device,
+				  char *trigger, size_t len)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->get_trigger(device, trigger, len);
+}
+
+static int32_t legacy_set_trigger(void *priv, const char *device,
+				  const char *trigger, size_t len)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->set_trigger(device, trigger, len);
+}
+
+static int32_t legacy_set_timeout(void *priv, uint32_t timeout)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->set_timeout(timeout);
+}
+
+static int32_t legacy_set_buffers_count(void *priv, const char *device,
+					uint32_t buffers_count)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->set_buffers_count(device, buffers_count);
+}
+
+static ssize_t legacy_get_xml(void *priv, char **outxml)
+{
+	const struct tinyiiod_ops *ops = priv;
+
+	return ops->get_xml(outxml);
+}
+
+struct tinyiiod * tinyiiod_create(struct tinyiiod_ops *legacy)
+{
+	struct tinyiiod_ops_priv *ops;
+	struct tinyiiod *iiod;
+
+	ops = calloc(1, sizeof(*ops));
+	if (!ops)
+		return NULL;
+
+	if (legacy->read)
+		ops->read = legacy_read;
+	if (legacy->write)
+		ops->write = legacy_write;
+	if (legacy->read_line)
+		ops->read_line = legacy_read_line;
+	if (legacy->open_instance)
+		ops->open_instance = legacy_open_instance;
+	if (legacy->close_instance)
+		ops->close_instance = legacy_close_instance;
+	if (legacy->read_attr)
+		ops->read_attr = legacy_read_attr;
+	if (legacy->write_attr)
+		ops->write_attr = legacy_write_attr;
+	if (legacy->ch_read_attr)
+		ops->ch_read_attr = legacy_ch_read_attr;
+	if (legacy->ch_write_attr)
+		ops->ch_write_attr = legacy_ch_write_attr;
+	if (legacy->open)
+		ops->open = legacy_open;
+	if (legacy->close)
+		ops->close = legacy_close;
+	if (legacy->transfer_dev_to_mem)
+		ops->transfer_dev_to_mem = legacy_transfer_dev_to_mem;
+	if (legacy->read_data)
+		ops->read_data = legacy_read_data;
+	if (legacy->transfer_mem_to_dev)
+		ops->transfer_mem_to_dev = legacy_transfer_mem_to_dev;
+	if (legacy->write_data)
+		ops->write_data = legacy_write_data;
+	if (legacy->get_mask)
+		ops->get_mask = legacy_get_mask;
+	if (legacy->get_trigger)
+		ops->get_trigger = legacy_get_trigger;
+	if (legacy->set_trigger)
+		ops->set_trigger = legacy_set_trigger;
+	if (legacy->set_timeout)
+		ops->set_timeout = legacy_set_timeout;
+	if (legacy->set_buffers_count)
+		ops->set_buffers_count = legacy_set_buffers_count;
+	if (legacy->get_xml)
+		ops->get_xml = legacy_get_xml;
+
+	iiod = tinyiiod_create_priv(ops, legacy);
+	if (!iiod) {
+		free(ops);
+		return NULL;
+	}
+
+	/* Freed with the instance */
+	iiod->legacy = true;
+
+	return iiod;
+}
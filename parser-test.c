@@ -0,0 +1,92 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Checks that every command of the text protocol has its own slot in the
+ * perfect-hashed table of parser.c: a command overwritten by another one
+ * when the table is built, or put in the wrong slot, is not found.
+ */
+
+#include "tinyiiod-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+	const char *name;
+	enum tinyiiod_opcode op;
+} expected[] = {
+	{ "VERSION", TINYIIOD_OP_VERSION },
+	{ "PRINT", TINYIIOD_OP_PRINT },
+	{ "ZPRINT", TINYIIOD_OP_ZPRINT },
+	{ "READ", TINYIIOD_OP_READ },
+	{ "WRITE", TINYIIOD_OP_WRITE },
+	{ "OPEN", TINYIIOD_OP_OPEN },
+	{ "CLOSE", TINYIIOD_OP_CLOSE },
+	{ "READBUF", TINYIIOD_OP_READBUF },
+	{ "STREAM", TINYIIOD_OP_STREAM },
+	{ "STOP", TINYIIOD_OP_STOP },
+	{ "TIMEOUT", TINYIIOD_OP_TIMEOUT },
+	{ "WRITEBUF", TINYIIOD_OP_WRITEBUF },
+	{ "REARM", TINYIIOD_OP_REARM },
+	{ "EXIT", TINYIIOD_OP_EXIT },
+	{ "BINARY", TINYIIOD_OP_TEXT },
+	{ "GETTRIG", TINYIIOD_OP_GETTRIG },
+	{ "SETTRIG", TINYIIOD_OP_SETTRIG },
+	{ "SET", TINYIIOD_OP_SET_BUFFERS_COUNT },
+};
+
+/* Prefixes, extensions and other spellings of the commands */
+static const char * const unknown[] = {
+	"R", "RE", "REA", "READX", "READBUFX", "read", "SETT", "PRIN",
+	"ZPRIN", "BINAR", "EXI", "X", "TEXT", "STO", "STOPS",
+};
+
+int main(void)
+{
+	const struct tinyiiod_command *cmd;
+	char line[32];
+	size_t i, len;
+	int ret = EXIT_SUCCESS;
+
+	for (i = 0; i < ARRAY_SIZE(expected); i++) {
+		/* Found with arguments after it, as in a command line */
+		len = strlen(expected[i].name);
+		snprintf(line, sizeof(line), "%s adc 1", expected[i].name);
+
+		cmd = tinyiiod_find_command(line, len);
+		if (!cmd || strcmp(cmd->name, expected[i].name) ||
+		    cmd->op != expected[i].op || !cmd->handler) {
+			fprintf(stderr, "%s: not in its slot\n",
+				expected[i].name);
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(unknown); i++) {
+		if (tinyiiod_find_command(unknown[i], strlen(unknown[i]))) {
+			fprintf(stderr, "\"%s\": found\n", unknown[i]);
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	if (ret == EXIT_SUCCESS)
+		printf("%u commands found in their slots\n",
+		       (unsigned int) ARRAY_SIZE(expected));
+
+	return ret;
+}
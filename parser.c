@@ -86,12 +86,50 @@ static int32_t parse_rw_string(struct tinyiiod *iiod, char *str, bool write)
 	return 0;
 }
 
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+/* Parse a mask of any width, the last 8 digits being channels 0 to 31 */
+static int32_t parse_mask(char *str, char **end, struct tinyiiod_mask *mask)
+{
+	size_t i, pos, len = 0;
+	uint32_t digit;
+
+	while (hex_digit(str[len]) >= 0)
+		len++;
+	if (!len || len > TINYIIOD_MAX_MASK_WORDS * 8)
+		return -EINVAL;
+
+	mask->nb_words = (len + 7) / 8;
+	memset(mask->words, 0, sizeof(mask->words));
+
+	for (i = 0; i < len; i++) {
+		pos = len - 1 - i;
+		digit = (uint32_t) hex_digit(str[i]);
+		mask->words[pos / 8] |= digit << (pos % 8 * 4);
+	}
+
+	*end = str + len;
+
+	return 0;
+}
+
 static int32_t parse_open_string(struct tinyiiod *iiod, char *str)
 {
 	char *device, *ptr;
 	long samples_count;
-	uint32_t mask = 0;
+	struct tinyiiod_mask mask;
 	bool cyclic = false;
+	int32_t ret;
 
 	ptr = strchr(str, ' ');
 	if (!ptr)
@@ -107,7 +145,9 @@ static int32_t parse_open_string(struct tinyiiod *iiod, char *str)
 
 	str = ptr + 1;
 
-	mask = strtoul(str, &ptr, 16);
+	ret = parse_mask(str, &ptr, &mask);
+	if (ret < 0)
+		return ret;
 
 	if (*ptr == ' ') {
 		str = ptr + 1;
@@ -117,7 +157,7 @@ static int32_t parse_open_string(struct tinyiiod *iiod, char *str)
 			return -EINVAL;
 	}
 
-	tinyiiod_do_open(iiod, device, (size_t) samples_count, mask, cyclic);
+	tinyiiod_do_open(iiod, device, (size_t) samples_count, &mask, cyclic);
 
 	return 0;
 }
@@ -218,64 +258,367 @@ static int32_t parse_settrig_string(struct tinyiiod *iiod, char *str)
 	return tinyiiod_do_settrig(iiod, device, trig, strlen(trig));
 }
 
-int32_t tinyiiod_parse_string(struct tinyiiod *iiod, char *str)
+static void write_version(struct tinyiiod *iiod)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%"PRIu16".%"PRIu16".%s",
+		 TINYIIOD_VERSION_MAJOR,
+		 TINYIIOD_VERSION_MINOR,
+		 TINYIIOD_VERSION_GIT);
+
+	/* The text protocol has no status line for VERSION */
+	if (iiod->binary)
+		tinyiiod_write_reply(iiod, 0, strlen(buf));
+	tinyiiod_write_string(iiod, buf);
+	tinyiiod_write_eol(iiod);
+}
+
+static int32_t parse_version_string(struct tinyiiod *iiod, char *str)
+{
+	if (*str)
+		return -EINVAL;
+
+	write_version(iiod);
+
+	return 0;
+}
+
+static int32_t parse_print_string(struct tinyiiod *iiod, char *str)
+{
+	if (*str)
+		return -EINVAL;
+
+	tinyiiod_write_xml(iiod);
+
+	return 0;
+}
+
+static int32_t parse_zprint_string(struct tinyiiod *iiod, char *str)
+{
+	if (*str)
+		return -EINVAL;
+
+	tinyiiod_write_compressed_xml(iiod);
+
+	return 0;
+}
+
+static int32_t parse_read_string(struct tinyiiod *iiod, char *str)
+{
+	return parse_rw_string(iiod, str, false);
+}
+
+static int32_t parse_write_string(struct tinyiiod *iiod, char *str)
+{
+	return parse_rw_string(iiod, str, true);
+}
+
+static int32_t parse_stream_string(struct tinyiiod *iiod, char *str)
+{
+	char *device, *ptr;
+	long bytes_count;
+
+	ptr = strchr(str, ' ');
+	if (!ptr)
+		return -EINVAL;
+
+	*ptr = '\0';
+	device = str;
+	str = ptr + 1;
+
+	bytes_count = strtol(str, &ptr, 10);
+	if (str == ptr || *ptr != '\0' || bytes_count < 0)
+		return -EINVAL;
+
+	return tinyiiod_do_stream(iiod, device, (size_t) bytes_count);
+}
+
+static int32_t parse_stop_string(struct tinyiiod *iiod, char *str)
+{
+	if (!*str)
+		return -EINVAL;
+
+	return tinyiiod_do_stop(iiod, str);
+}
+
+static int32_t parse_close_string(struct tinyiiod *iiod, char *str)
+{
+	if (!*str)
+		return -EINVAL;
+
+	tinyiiod_do_close(iiod, str);
+
+	return 0;
+}
+
+static int32_t parse_rearm_string(struct tinyiiod *iiod, char *str)
+{
+	if (!*str)
+		return -EINVAL;
+
+	return tinyiiod_do_rearm(iiod, str);
+}
+
+static int32_t parse_exit_string(struct tinyiiod *iiod, char *str)
+{
+	return tinyiiod_do_close_instance(iiod);
+}
+
+static int32_t parse_binary_string(struct tinyiiod *iiod, char *str)
+{
+	if (*str)
+		return -EINVAL;
+
+	/* Acknowledged in text; the next request must be binary */
+	tinyiiod_write_value(iiod, 0);
+	iiod->binary = true;
+
+	return 0;
+}
+
+/* Perfect hash on the first two characters and the length of the command
+ * name: every command below has its own slot of commands[]. A collision
+ * shows up as -Woverride-init when building, and in parser-test. */
+#define COMMAND_HASH(c0, c1, len) (((c0) + 12 * (c1) + 9 * (len)) & 31)
+
+/* The first two characters are spelled out, as string literals can't be
+ * indexed in a constant expression */
+#define COMMAND(c0, c1, name, op, handler) \
+	[COMMAND_HASH(c0, c1, sizeof(name) - 1)] = \
+		{ name, handler, TINYIIOD_OP_##op }
+
+static const struct tinyiiod_command commands[32] = {
+	COMMAND('V', 'E', "VERSION", VERSION, parse_version_string),
+	COMMAND('P', 'R', "PRINT", PRINT, parse_print_string),
+	COMMAND('Z', 'P', "ZPRINT", ZPRINT, parse_zprint_string),
+	COMMAND('R', 'E', "READ", READ, parse_read_string),
+	COMMAND('W', 'R', "WRITE", WRITE, parse_write_string),
+	COMMAND('O', 'P', "OPEN", OPEN, parse_open_string),
+	COMMAND('C', 'L', "CLOSE", CLOSE, parse_close_string),
+	COMMAND('R', 'E', "READBUF", READBUF, parse_readbuf_string),
+	COMMAND('S', 'T', "STREAM", STREAM, parse_stream_string),
+	COMMAND('S', 'T', "STOP", STOP, parse_stop_string),
+	COMMAND('T', 'I', "TIMEOUT", TIMEOUT, parse_timeout_string),
+	COMMAND('W', 'R', "WRITEBUF", WRITEBUF, parse_writebuf_string),
+	COMMAND('R', 'E', "REARM", REARM, parse_rearm_string),
+	COMMAND('E', 'X', "EXIT", EXIT, parse_exit_string),
+	COMMAND('B', 'I', "BINARY", TEXT, parse_binary_string),
+	COMMAND('G', 'E', "GETTRIG", GETTRIG, parse_gettrig_string),
+	COMMAND('S', 'E', "SETTRIG", SETTRIG, parse_settrig_string),
+	COMMAND('S', 'E', "SET", SET_BUFFERS_COUNT, parse_set_string),
+};
+
+const struct tinyiiod_command *
+tinyiiod_find_command(const char *name, size_t len)
 {
+	const struct tinyiiod_command *cmd;
+
+	/* name[1] is the terminating space or NUL for 1-char names */
+	cmd = &commands[COMMAND_HASH(name[0], name[1], len)];
+	if (!cmd->name || strncmp(cmd->name, name, len) || cmd->name[len])
+		return NULL;
+
+	return cmd;
+}
+
+static int32_t parse_command(struct tinyiiod *iiod, char *str)
+{
+	const struct tinyiiod_command *cmd;
+	char *args;
+	size_t len;
+
 	while (*str == '\n' || *str == '\r')
 		str++;
 
 	if (str[0] == '\0')
 		return 0;
 
-	if (!strncmp(str, "VERSION", sizeof("VERSION"))) {
-		char buf[32];
+	tinyiiod_stats_begin(iiod);
 
-		snprintf(buf, sizeof(buf), "%"PRIu16".%"PRIu16".%s\n",
-			 TINYIIOD_VERSION_MAJOR,
-			 TINYIIOD_VERSION_MINOR,
-			 TINYIIOD_VERSION_GIT);
-		tinyiiod_write_string(iiod, buf);
-		return 0;
+	args = strchr(str, ' ');
+	if (args) {
+		len = (size_t) (args - str);
+		args++;
+	} else {
+		len = strlen(str);
+		args = str + len;
 	}
 
-	if (!strncmp(str, "PRINT", sizeof("PRINT"))) {
-		tinyiiod_write_xml(iiod);
+	cmd = tinyiiod_find_command(str, len);
+	if (!cmd)
+		return -EINVAL;
+
+	tinyiiod_stats_parsed(iiod, cmd->op);
+
+	return cmd->handler(iiod, args);
+}
+
+int32_t tinyiiod_parse_string(struct tinyiiod *iiod, char *str)
+{
+	int32_t ret = parse_command(iiod, str);
+
+	/* Send the whole response in one go */
+	tinyiiod_flush(iiod);
+
+	tinyiiod_stats_end(iiod, ret);
+
+	return ret;
+}
+
+/* Return the next NUL-terminated argument of a binary request */
+static char *next_arg(char **args, size_t *len)
+{
+	char *arg = *args, *end = memchr(arg, '\0', *len);
+
+	if (!end)
+		return NULL;
+
+	*len -= (size_t) (end - arg) + 1;
+	*args = end + 1;
+
+	return arg;
+}
+
+/* Malformed requests still get an answer, or the client would hang */
+static int32_t invalid_frame(struct tinyiiod *iiod)
+{
+	tinyiiod_write_value(iiod, -EINVAL);
+
+	return -EINVAL;
+}
+
+static int32_t parse_frame_rw(struct tinyiiod *iiod, char *args, size_t len,
+			      unsigned char flags, int32_t code, bool write)
+{
+	char *device, *channel = NULL, *attr;
+	enum iio_attr_type type = TINYIIOD_FLAG_TYPE(flags);
+
+	device = next_arg(&args, &len);
+	if (device && (flags & TINYIIOD_FLAG_CHANNEL))
+		channel = next_arg(&args, &len);
+	attr = next_arg(&args, &len);
+	if (!attr || ((flags & TINYIIOD_FLAG_CHANNEL) && !channel))
+		return invalid_frame(iiod);
+
+	if (!write) {
+		tinyiiod_do_read_attr(iiod, device, channel,
+				      flags & TINYIIOD_FLAG_OUTPUT, attr, type);
 		return 0;
 	}
 
-	if (!strncmp(str, "READ ", sizeof("READ ") - 1))
-		return parse_rw_string(iiod, str + sizeof("READ ") - 1, false);
+	if (code < 0)
+		return invalid_frame(iiod);
 
-	if (!strncmp(str, "WRITE ", sizeof("WRITE ") -1))
-		return parse_rw_string(iiod, str + sizeof("WRITE ") - 1, true);
+	tinyiiod_do_write_attr(iiod, device, channel,
+			       flags & TINYIIOD_FLAG_OUTPUT, attr,
+			       (size_t) code, type);
 
-	if (!strncmp(str, "OPEN ", sizeof("OPEN ") -1))
-		return parse_open_string(iiod, str + sizeof("OPEN ") - 1);
+	return 0;
+}
 
-	if (!strncmp(str, "CLOSE ", sizeof("CLOSE ") -1)) {
-		tinyiiod_do_close(iiod, str + sizeof("CLOSE ") - 1);
+static int32_t parse_frame_command(struct tinyiiod *iiod, char *frame)
+{
+	unsigned char op = (unsigned char) frame[0];
+	unsigned char flags = (unsigned char) frame[2];
+	size_t len = tinyiiod_get_le32(frame + 4);
+	int32_t code = (int32_t) tinyiiod_get_le32(frame + 8);
+	char *args = frame + TINYIIOD_BINARY_HEADER_SIZE;
+	char *device, *trigger;
+	struct tinyiiod_mask mask;
+	size_t i;
+
+	iiod->client_id = (unsigned char) frame[1];
+	tinyiiod_stats_parsed(iiod, (enum tinyiiod_opcode) op);
+
+	switch (op) {
+	case TINYIIOD_OP_VERSION:
+		write_version(iiod);
+		return 0;
+	case TINYIIOD_OP_PRINT:
+		tinyiiod_write_xml(iiod);
+		return 0;
+	case TINYIIOD_OP_ZPRINT:
+		tinyiiod_write_compressed_xml(iiod);
+		return 0;
+	case TINYIIOD_OP_READ:
+	case TINYIIOD_OP_WRITE:
+		return parse_frame_rw(iiod, args, len, flags, code,
+				      op == TINYIIOD_OP_WRITE);
+	case TINYIIOD_OP_TIMEOUT:
+		return tinyiiod_set_timeout(iiod, (uint32_t) code);
+	case TINYIIOD_OP_EXIT:
+		return tinyiiod_do_close_instance(iiod);
+	case TINYIIOD_OP_TEXT:
+		tinyiiod_write_value(iiod, 0);
+		iiod->binary = false;
 		return 0;
+	default:
+		break;
 	}
 
-	if (!strncmp(str, "READBUF ", sizeof("READBUF ") -1))
-		return parse_readbuf_string(iiod, str + sizeof("READBUF ") - 1);
+	/* All the other commands work on a device */
+	device = next_arg(&args, &len);
+	if (!device)
+		return invalid_frame(iiod);
 
-	if (!strncmp(str, "TIMEOUT ", sizeof("TIMEOUT ") - 1))
-		return parse_timeout_string(iiod, str + sizeof("TIMEOUT ") - 1);
+	switch (op) {
+	case TINYIIOD_OP_OPEN:
+		if (code < 0 || !len || len % 4 ||
+		    len > TINYIIOD_MAX_MASK_WORDS * 4)
+			return invalid_frame(iiod);
 
-	if (!strncmp(str, "WRITEBUF ", sizeof("WRITEBUF ") -1))
-		return parse_writebuf_string(iiod, str + sizeof("WRITEBUF ") - 1);
+		for (i = 0; i < len / 4; i++)
+			mask.words[i] = tinyiiod_get_le32(args + i * 4);
+		mask.nb_words = len / 4;
 
-	if (!strncmp(str, "EXIT", sizeof("EXIT") - 1))
-		return tinyiiod_do_close_instance(iiod);
+		tinyiiod_do_open(iiod, device, (size_t) code, &mask,
+				 flags & TINYIIOD_FLAG_CYCLIC);
+		return 0;
+	case TINYIIOD_OP_CLOSE:
+		tinyiiod_do_close(iiod, device);
+		return 0;
+	case TINYIIOD_OP_READBUF:
+		if (code < 0)
+			return invalid_frame(iiod);
+		return tinyiiod_do_readbuf(iiod, device, (size_t) code);
+	case TINYIIOD_OP_STREAM:
+		if (code < 0)
+			return invalid_frame(iiod);
+		return tinyiiod_do_stream(iiod, device, (size_t) code);
+	case TINYIIOD_OP_STOP:
+		return tinyiiod_do_stop(iiod, device);
+	case TINYIIOD_OP_WRITEBUF:
+		if (code < 0)
+			return invalid_frame(iiod);
+		return tinyiiod_do_writebuf(iiod, device, (size_t) code);
+	case TINYIIOD_OP_REARM:
+		return tinyiiod_do_rearm(iiod, device);
+	case TINYIIOD_OP_SET_BUFFERS_COUNT:
+		return tinyiiod_set_buffers_count(iiod, device, (uint32_t) code);
+	case TINYIIOD_OP_GETTRIG:
+		return tinyiiod_do_gettrig(iiod, device);
+	case TINYIIOD_OP_SETTRIG:
+		trigger = next_arg(&args, &len);
+		if (!trigger)
+			return tinyiiod_do_settrig(iiod, device, "", 0);
+		return tinyiiod_do_settrig(iiod, device, trigger,
+					   strlen(trigger));
+	default:
+		return invalid_frame(iiod);
+	}
+}
+
+int32_t tinyiiod_parse_frame(struct tinyiiod *iiod, char *frame)
+{
+	int32_t ret;
 
-	if (!strncmp(str, "GETTRIG", sizeof("GETTRIG") - 1))
-		return parse_gettrig_string(iiod, str + sizeof("GETTRIG ") - 1);
+	tinyiiod_stats_begin(iiod);
 
-	if (!strncmp(str, "SETTRIG", sizeof("SETTRIG") - 1))
-		return parse_settrig_string(iiod, str + sizeof("SETTRIG ") - 1);
+	ret = parse_frame_command(iiod, frame);
+	tinyiiod_flush(iiod);
 
-	if (!strncmp(str, "SET", sizeof("SET") - 1))
-		return parse_set_string(iiod, str + sizeof("SET ") - 1);
+	tinyiiod_stats_end(iiod, ret);
 
-	return -EINVAL;
+	return ret;
 }
@@ -0,0 +1,226 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Compares tinyiiod_pack_scans() with a plain copy of every enabled
+ * channel, on random layouts. Build it with -mssse3 on x86 to check the
+ * shuffle kernel too; on AArch64 the NEON one is always used.
+ */
+
+#include "tinyiiod-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_LAYOUTS	2000
+#define MAX_CHANNELS	(IIOD_MAX_SCAN_CHANNELS < 40 ? \
+			 IIOD_MAX_SCAN_CHANNELS : 40)
+#define MAX_SCANS	100
+
+struct channel {
+	long index;
+	size_t length;
+};
+
+static uint32_t seed = 1;
+
+static uint32_t rand32(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+static size_t align(size_t offset, size_t length)
+{
+	return (offset + length - 1) / length * length;
+}
+
+static void random_layout(struct channel *channels, size_t *nb,
+			  struct tinyiiod_mask *mask)
+{
+	/* Short scans most of the time, as only those are vectorized */
+	bool small = rand32() % 2;
+	size_t i, n = 1 + rand32() % (small ? 4 : MAX_CHANNELS);
+	long index = 0;
+
+	for (i = 0; i < n; i++) {
+		/* Channels sharing an index share their sample too */
+		if (i && !(rand32() % 8)) {
+			channels[i] = channels[i - 1];
+			continue;
+		}
+
+		channels[i].index = index;
+		channels[i].length = (size_t) 1 << rand32() % (small ? 2 : 4);
+		index += 1 + rand32() % 2;
+	}
+
+	mask->nb_words = (n + 31) / 32;
+	for (i = 0; i < mask->nb_words; i++)
+		mask->words[i] = rand32() % 2 ? rand32() : ~0u;
+
+	*nb = n;
+}
+
+static size_t print_xml(char *xml, size_t len,
+			const struct channel *channels, size_t nb)
+{
+	size_t i, off;
+
+	off = (size_t) snprintf(xml, len, "<context name=\"test\" >"
+				"<device id=\"iio:device0\" name=\"adc\" >");
+
+	for (i = 0; i < nb; i++)
+		off += (size_t) snprintf(xml + off, len - off,
+			"<channel id=\"voltage%u\" type=\"input\" >"
+			"<scan-element index=\"%ld\" "
+			"format=\"le:u%u/%u&gt;&gt;0\" /></channel>",
+			(unsigned int) i, channels[i].index,
+			(unsigned int) channels[i].length * 8,
+			(unsigned int) channels[i].length * 8);
+
+	off += (size_t) snprintf(xml + off, len - off,
+				 "</device></context>");
+
+	return off;
+}
+
+/* The libiio rules: every sample aligned on its own size */
+static size_t pack_reference(const struct channel *channels, size_t nb,
+			     const struct tinyiiod_mask *mask,
+			     char *dst, const char *src, size_t nb_scans,
+			     size_t *scan_size)
+{
+	size_t i, scan, src_off[MAX_CHANNELS], dst_off[MAX_CHANNELS];
+	size_t end = 0, packed = 0;
+	bool enabled[MAX_CHANNELS];
+	long last_index = -1;
+
+	for (i = 0; i < nb; i++) {
+		if (!i || channels[i].index != channels[i - 1].index) {
+			src_off[i] = align(end, channels[i].length);
+			end = src_off[i] + channels[i].length;
+		} else {
+			src_off[i] = src_off[i - 1];
+		}
+
+		enabled[i] = (mask->words[i / 32] & (1u << (i % 32))) &&
+			     (!packed || channels[i].index != last_index);
+		if (!enabled[i])
+			continue;
+
+		dst_off[i] = align(packed, channels[i].length);
+		packed = dst_off[i] + channels[i].length;
+		last_index = channels[i].index;
+	}
+
+	for (scan = 0; scan < nb_scans; scan++)
+		for (i = 0; i < nb; i++)
+			if (enabled[i])
+				memcpy(dst + scan * packed + dst_off[i],
+				       src + scan * end + src_off[i],
+				       channels[i].length);
+
+	*scan_size = end;
+
+	return packed;
+}
+
+int main(int argc, char **argv)
+{
+	static struct tinyiiod_scan_layout layout;
+	static char xml[MAX_CHANNELS * 128 + 128];
+	struct channel channels[MAX_CHANNELS];
+	struct tinyiiod_mask mask;
+	size_t i, j, nb, nb_scans, scan_size, packed;
+	char *src, *dst, *ref;
+	int32_t ret;
+
+	if (argc > 1)
+		seed = (uint32_t) strtoul(argv[1], NULL, 0) | 1;
+
+	for (i = 0; i < NB_LAYOUTS; i++) {
+		random_layout(channels, &nb, &mask);
+		print_xml(xml, sizeof(xml), channels, nb);
+
+		nb_scans = rand32() % (MAX_SCANS + 1);
+		packed = pack_reference(channels, nb, &mask, NULL, NULL, 0,
+					&scan_size);
+
+		ret = tinyiiod_scan_layout_init(&layout, xml, "adc", &mask,
+						IIOD_BUFFER_SIZE);
+		if (ret < 0) {
+			if (packed) {
+				fprintf(stderr, "layout %u: error %d\n",
+					(unsigned int) i, (int) ret);
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+
+		if (layout.scan_size != scan_size ||
+		    layout.packed_size != packed) {
+			fprintf(stderr, "layout %u: %u/%u bytes, expected %u/%u\n",
+				(unsigned int) i,
+				(unsigned int) layout.packed_size,
+				(unsigned int) layout.scan_size,
+				(unsigned int) packed,
+				(unsigned int) scan_size);
+			return EXIT_FAILURE;
+		}
+
+		/* Exact size, so that overreads show up with sanitizers */
+		src = malloc(nb_scans * scan_size + 1);
+		dst = malloc(nb_scans * packed + TINYIIOD_PACK_SLACK);
+		ref = malloc(nb_scans * packed + 1);
+		if (!src || !dst || !ref)
+			return EXIT_FAILURE;
+
+		for (j = 0; j < nb_scans * scan_size; j++)
+			src[j] = (char) rand32();
+
+		/* Padding between the samples is not written by the copies */
+		memset(dst, 0, nb_scans * packed);
+		memset(ref, 0, nb_scans * packed);
+
+		pack_reference(channels, nb, &mask, ref, src, nb_scans,
+			       &scan_size);
+		tinyiiod_pack_scans(&layout, dst, src, nb_scans);
+
+		for (j = 0; j < nb_scans * packed; j++) {
+			if (dst[j] != ref[j]) {
+				fprintf(stderr, "layout %u: scan %u of %u, "
+					"byte %u differs\n", (unsigned int) i,
+					(unsigned int) (j / packed),
+					(unsigned int) nb_scans,
+					(unsigned int) (j % packed));
+				return EXIT_FAILURE;
+			}
+		}
+
+		free(src);
+		free(dst);
+		free(ref);
+	}
+
+	printf("%u layouts packed like the reference\n", NB_LAYOUTS);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,290 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define TINYIIOD_PACK_NEON
+#endif
+
+/*
+ * Extraction of the enabled channels from the full scans captured by the
+ * backend. The layout comes from the scan-element tags of the context XML
+ * and follows the rules of libiio: every sample is aligned on its own size,
+ * channels sorted by scan index, and channels sharing an index share their
+ * sample. Samples are copied as they are; shift and endianness are left
+ * to the client, which reads them from the same XML.
+ */
+
+struct scan_channel {
+	long index;
+	size_t length;
+};
+
+/* Sample size, in bytes, of a format like "le:s12/16X2>>4" */
+static size_t parse_format(const char *fmt, size_t len)
+{
+	const char *ptr = memchr(fmt, ':', len);
+	unsigned long storage, repeat = 1;
+	char *end;
+
+	if (!ptr || ptr + 2 >= fmt + len)
+		return 0;
+
+	/* Skip the sign and the number of significant bits */
+	strtoul(ptr + 2, &end, 10);
+	if (*end != '/')
+		return 0;
+
+	storage = strtoul(end + 1, &end, 10);
+	if (*end == 'X')
+		repeat = strtoul(end + 1, &end, 10);
+
+	if (!storage || storage % 8 || storage > 64 || !repeat)
+		return 0;
+
+	return storage / 8 * repeat;
+}
+
+/* Collect the scan elements of a device, sorted by index */
+static int32_t get_scan_channels(const char *xml, const char *device,
+				 struct scan_channel *channels, size_t *nb)
+{
+	const char *dev, *dev_end, *chn, *chn_end, *elem, *value;
+	struct scan_channel tmp;
+	size_t i, len, n = 0;
+
+	dev = tinyiiod_xml_device(xml, device, &dev_end);
+	if (!dev)
+		return -ENODEV;
+
+	for (chn = dev; (chn = tinyiiod_xml_find(chn, dev_end, "<channel "));
+	     chn++) {
+		chn_end = tinyiiod_xml_find(chn, dev_end, "</channel>");
+		if (!chn_end)
+			chn_end = dev_end;
+
+		elem = tinyiiod_xml_find(chn, chn_end, "<scan-element ");
+		if (!elem)
+			continue;
+
+		if (n == IIOD_MAX_SCAN_CHANNELS)
+			return -EINVAL;
+
+		value = tinyiiod_xml_attr(elem, "index", &len);
+		if (!value)
+			return -EINVAL;
+		channels[n].index = strtol(value, NULL, 10);
+
+		value = tinyiiod_xml_attr(elem, "format", &len);
+		if (!value)
+			return -EINVAL;
+		channels[n].length = parse_format(value, len);
+		if (!channels[n].length)
+			return -EINVAL;
+
+		/* Insertion sort: there are few channels, mostly in order */
+		for (i = n++; i && channels[i - 1].index > channels[i].index;
+		     i--) {
+			tmp = channels[i];
+			channels[i] = channels[i - 1];
+			channels[i - 1] = tmp;
+		}
+	}
+
+	*nb = n;
+
+	return n ? 0 : -EINVAL;
+}
+
+static size_t align(size_t offset, size_t length)
+{
+	if (offset % length)
+		offset += length - offset % length;
+
+	return offset;
+}
+
+static void add_run(struct tinyiiod_scan_layout *layout,
+		    size_t src, size_t dst, size_t length)
+{
+	struct tinyiiod_scan_run *run;
+
+	/* Neighbour channels are copied in one go */
+	if (layout->nb_runs) {
+		run = &layout->runs[layout->nb_runs - 1];
+		if (run->src + run->len == src && run->dst + run->len == dst) {
+			run->len += (unsigned short) length;
+			return;
+		}
+	}
+
+	run = &layout->runs[layout->nb_runs++];
+	run->src = (unsigned short) src;
+	run->dst = (unsigned short) dst;
+	run->len = (unsigned short) length;
+}
+
+static void build_shuffle(struct tinyiiod_scan_layout *layout)
+{
+	const struct tinyiiod_scan_run *run;
+	size_t i, j, scan;
+
+	layout->vec_scans = 0;
+	if (layout->scan_size > 16 || layout->packed_size == layout->scan_size)
+		return;
+
+	/* Pack as many scans as one 16-byte vector holds */
+	layout->vec_scans = 16 / layout->scan_size;
+	memset(layout->shuffle, 0x80, sizeof(layout->shuffle));
+
+	for (scan = 0; scan < layout->vec_scans; scan++)
+		for (i = 0; i < layout->nb_runs; i++) {
+			run = &layout->runs[i];
+			for (j = 0; j < run->len; j++)
+				layout->shuffle[scan * layout->packed_size +
+						run->dst + j] =
+					(unsigned char) (scan *
+							 layout->scan_size +
+							 run->src + j);
+		}
+}
+
+int32_t tinyiiod_scan_layout_init(struct tinyiiod_scan_layout *layout,
+				  const char *xml, const char *device,
+				  const struct tinyiiod_mask *mask,
+				  size_t buf_size)
+{
+	struct scan_channel channels[IIOD_MAX_SCAN_CHANNELS];
+	size_t i, nb, src = 0, scan = 0, packed = 0;
+	long last_index = -1;
+	bool enabled;
+	int32_t ret;
+
+	layout->valid = false;
+	layout->nb_runs = 0;
+
+	if (strlen(device) >= sizeof(layout->device))
+		return -EINVAL;
+
+	ret = get_scan_channels(xml, device, channels, &nb);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < nb; i++) {
+		if (!i || channels[i].index != channels[i - 1].index) {
+			src = align(scan, channels[i].length);
+			scan = src + channels[i].length;
+		}
+
+		enabled = i / 32 < mask->nb_words &&
+			  (mask->words[i / 32] & (1u << (i % 32)));
+		if (!enabled || (packed && channels[i].index == last_index))
+			continue;
+
+		packed = align(packed, channels[i].length);
+		add_run(layout, src, packed, channels[i].length);
+		packed += channels[i].length;
+		last_index = channels[i].index;
+	}
+
+	if (!packed || scan > 0xffff ||
+	    packed > buf_size - TINYIIOD_PACK_SLACK)
+		return -EINVAL;
+
+	layout->scan_size = scan;
+	layout->packed_size = packed;
+	build_shuffle(layout);
+
+	strcpy(layout->device, device);
+	layout->mask = *mask;
+	layout->valid = true;
+
+	return 0;
+}
+
+static void pack_scalar(const struct tinyiiod_scan_layout *layout,
+			char *dst, const char *src, size_t nb_scans)
+{
+	const struct tinyiiod_scan_run *run, *end;
+
+	end = layout->runs + layout->nb_runs;
+
+	for (; nb_scans; nb_scans--) {
+		for (run = layout->runs; run != end; run++) {
+			/* Constant sizes let the compiler inline the copy */
+			switch (run->len) {
+			case 2:
+				memcpy(dst + run->dst, src + run->src, 2);
+				break;
+			case 4:
+				memcpy(dst + run->dst, src + run->src, 4);
+				break;
+			case 8:
+				memcpy(dst + run->dst, src + run->src, 8);
+				break;
+			default:
+				memcpy(dst + run->dst, src + run->src,
+				       run->len);
+				break;
+			}
+		}
+
+		src += layout->scan_size;
+		dst += layout->packed_size;
+	}
+}
+
+void tinyiiod_pack_scans(const struct tinyiiod_scan_layout *layout,
+			 char *dst, const char *src, size_t nb_scans)
+{
+#if defined(__SSSE3__) || defined(TINYIIOD_PACK_NEON)
+	size_t in = layout->vec_scans * layout->scan_size;
+	size_t out = layout->vec_scans * layout->packed_size;
+
+	if (layout->vec_scans) {
+#if defined(__SSSE3__)
+		__m128i ctl = _mm_loadu_si128((const __m128i *) layout->shuffle);
+#else
+		uint8x16_t ctl = vld1q_u8(layout->shuffle);
+#endif
+
+		/* Stop when a 16-byte load would go past the last scan */
+		for (; nb_scans * layout->scan_size >= 16;
+		     nb_scans -= layout->vec_scans) {
+#if defined(__SSSE3__)
+			__m128i v = _mm_loadu_si128((const __m128i *) src);
+
+			_mm_storeu_si128((__m128i *) dst,
+					 _mm_shuffle_epi8(v, ctl));
+#else
+			uint8x16_t v = vld1q_u8((const uint8_t *) src);
+
+			vst1q_u8((uint8_t *) dst, vqtbl1q_u8(v, ctl));
+#endif
+			src += in;
+			dst += out;
+		}
+	}
+#endif
+
+	pack_scalar(layout, dst, src, nb_scans);
+}
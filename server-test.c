@@ -0,0 +1,318 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Starts the reference server and connects clients to it that poll
+ * attributes, one request in flight each, all at the same time. Every
+ * reply is checked, and the latency of the requests is printed as one
+ * JSON object:
+ *
+ *   clients, requests            how many clients, requests in total
+ *   p50_us, p90_us, p99_us       percentiles of the latency
+ *   max_us
+ *
+ * Usage: tinyiiod-server-test [-c clients] [-n requests] [-p port] server
+ *
+ * requests is the number of requests of each client (default 2000), and
+ * port the one the server is started on (default 30431 plus some of the
+ * PID, so that concurrent runs don't collide).
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_CLIENTS		16
+#define TEST_REQUESTS		2000
+#define TEST_PORT		30431
+#define TEST_TIMEOUT_MS		5000
+
+static const struct {
+	const char *request;
+	const char *reply;
+} polls[] = {
+	{ "READ adc sample_rate\r\n", "4\n1000\n" },
+	{ "READ adc INPUT voltage0 scale\r\n", "5\n0.033\n" },
+	{ "READ 0 INPUT voltage1 scale\r\n", "5\n0.033\n" },
+	{ "READ adc INPUT voltage2 scale\r\n", "-2\n" },
+};
+
+struct client {
+	int fd;
+	unsigned int sent, poll;
+	uint64_t start;
+	char reply[32];
+	size_t reply_len;
+};
+
+static uint64_t get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* The server needs some time to listen: retry until it does */
+static int connect_client(pid_t server, uint16_t port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		.sin_port = htons(port),
+	};
+	uint64_t deadline = get_time_us() + TEST_TIMEOUT_MS * 1000;
+	int fd, yes = 1;
+
+	for (;;) {
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -errno;
+
+		if (!connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+			break;
+
+		close(fd);
+		if (errno != ECONNREFUSED || get_time_us() > deadline ||
+		    waitpid(server, NULL, WNOHANG))
+			return -ECONNREFUSED;
+
+		usleep(10000);
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+	return fd;
+}
+
+static int send_request(struct client *client)
+{
+	const char *request = polls[client->poll].request;
+	size_t len = strlen(request);
+
+	client->start = get_time_us();
+	client->reply_len = 0;
+
+	if (send(client->fd, request, len, MSG_NOSIGNAL) != (ssize_t) len)
+		return -EIO;
+
+	client->sent++;
+
+	return 0;
+}
+
+/* Returns 1 once the whole reply is in, 0 while some is missing */
+static int receive_reply(struct client *client)
+{
+	const char *reply = polls[client->poll].reply;
+	size_t len = strlen(reply);
+	ssize_t ret;
+
+	ret = recv(client->fd, client->reply + client->reply_len,
+		   len - client->reply_len, 0);
+	if (ret <= 0)
+		return -EIO;
+
+	client->reply_len += (size_t) ret;
+	if (client->reply_len < len)
+		return 0;
+
+	if (memcmp(client->reply, reply, len)) {
+		fprintf(stderr, "%.*s: unexpected reply %.*s\n",
+			(int) strlen(polls[client->poll].request) - 2,
+			polls[client->poll].request,
+			(int) len, client->reply);
+		return -EPROTO;
+	}
+
+	return 1;
+}
+
+static int run(struct client *clients, unsigned int nb_clients,
+	       unsigned int nb_requests, uint32_t *latencies)
+{
+	struct pollfd *fds;
+	unsigned int i, nb_done = 0, nb_lat = 0;
+	int ret = 0, n;
+
+	fds = calloc(nb_clients, sizeof(*fds));
+	if (!fds)
+		return -ENOMEM;
+
+	for (i = 0; i < nb_clients && !ret; i++) {
+		fds[i].fd = clients[i].fd;
+		fds[i].events = POLLIN;
+		clients[i].poll = i % (sizeof(polls) / sizeof(polls[0]));
+		ret = send_request(&clients[i]);
+	}
+
+	while (!ret && nb_done < nb_clients) {
+		n = poll(fds, nb_clients, TEST_TIMEOUT_MS);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, "No reply from the server\n");
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		for (i = 0; i < nb_clients && !ret; i++) {
+			if (!fds[i].revents)
+				continue;
+
+			ret = receive_reply(&clients[i]);
+			if (ret <= 0)
+				continue;
+
+			latencies[nb_lat++] = (uint32_t) (get_time_us() -
+							  clients[i].start);
+
+			if (clients[i].sent == nb_requests) {
+				fds[i].fd = -1;
+				nb_done++;
+				ret = 0;
+				continue;
+			}
+
+			clients[i].poll = (clients[i].poll + 1) %
+					  (sizeof(polls) / sizeof(polls[0]));
+			ret = send_request(&clients[i]);
+		}
+	}
+
+	free(fds);
+
+	return ret < 0 ? ret : (int) nb_lat;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nb_clients = TEST_CLIENTS, nb_requests = TEST_REQUESTS;
+	uint16_t port = (uint16_t) (TEST_PORT + getpid() % 1000);
+	struct client *clients = NULL;
+	uint32_t *latencies = NULL;
+	unsigned int i, nb = 0;
+	int opt, status, ret;
+	char port_str[8];
+	pid_t server;
+
+	while ((opt = getopt(argc, argv, "c:n:p:")) != -1) {
+		switch (opt) {
+		case 'c':
+			nb_clients = (unsigned int) strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nb_requests = (unsigned int) strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			port = (uint16_t) strtoul(optarg, NULL, 0);
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+
+	if (optind != argc - 1 || !nb_clients || !nb_requests) {
+		fprintf(stderr, "Usage: %s [-c clients] [-n requests] "
+			"[-p port] server\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(port_str, sizeof(port_str), "%u", port);
+
+	server = fork();
+	if (server < 0)
+		return EXIT_FAILURE;
+	if (!server) {
+		execl(argv[optind], argv[optind], port_str, (char *) NULL);
+		fprintf(stderr, "Unable to start %s: %s\n",
+			argv[optind], strerror(errno));
+		_exit(EXIT_FAILURE);
+	}
+
+	clients = calloc(nb_clients, sizeof(*clients));
+	latencies = calloc((size_t) nb_clients * nb_requests,
+			   sizeof(*latencies));
+	if (!clients || !latencies) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	for (nb = 0; nb < nb_clients; nb++) {
+		ret = connect_client(server, port);
+		if (ret < 0) {
+			fprintf(stderr, "Unable to connect to port %u: %s\n",
+				port, strerror(-ret));
+			goto out_stop;
+		}
+
+		clients[nb].fd = ret;
+	}
+
+	ret = run(clients, nb_clients, nb_requests, latencies);
+	if (ret < 0)
+		goto out_stop;
+
+	qsort(latencies, (size_t) ret, sizeof(*latencies), cmp_u32);
+
+	printf("{\"clients\":%u,\"requests\":%d,\"p50_us\":%u,"
+	       "\"p90_us\":%u,\"p99_us\":%u,\"max_us\":%u}\n",
+	       nb_clients, ret,
+	       latencies[(size_t) ret * 50 / 100],
+	       latencies[(size_t) ret * 90 / 100],
+	       latencies[(size_t) ret * 99 / 100],
+	       latencies[ret - 1]);
+	ret = 0;
+
+out_stop:
+	for (i = 0; i < nb; i++)
+		close(clients[i].fd);
+
+	/* The server must still be running, and stop cleanly */
+	kill(server, SIGTERM);
+	if (waitpid(server, &status, 0) != server || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != EXIT_SUCCESS) {
+		fprintf(stderr, "The server did not exit cleanly\n");
+		ret = -ECHILD;
+	}
+
+	free(latencies);
+	free(clients);
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,453 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Reference multi-client TCP server for Linux: every connection gets its
+ * own tinyiiod instance, and all of them are multiplexed with epoll on
+ * non-blocking sockets from a single thread.
+ */
+
+#define _GNU_SOURCE
+
+#include "tinyiiod.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SERVER_PORT	30431
+#define MAX_EVENTS	64
+
+struct client {
+	int fd;
+	bool closed;
+	struct tinyiiod *iiod;
+
+	/* Response bytes the socket did not accept yet */
+	char *out;
+	size_t out_len, out_size;
+	uint32_t events;
+
+	/* Capture buffer of the demo device */
+	bool opened;
+	uint32_t mask;
+	uint16_t sample;
+};
+
+static uint32_t sample_rate = 1000;
+static uint32_t raw[2];
+
+static void client_send(struct client *client)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < client->out_len) {
+		ret = send(client->fd, client->out + done,
+			   client->out_len - done, MSG_NOSIGNAL);
+		if (ret > 0) {
+			done += ret;
+			continue;
+		}
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			client->closed = true;
+		break;
+	}
+
+	memmove(client->out, client->out + done, client->out_len - done);
+	client->out_len -= done;
+}
+
+/* Queue the response; it is sent as fast as the socket takes it */
+static ssize_t client_write(void *priv, const char *buf, size_t len)
+{
+	struct client *client = priv;
+	size_t size;
+	char *out;
+
+	if (client->out_len + len > client->out_size) {
+		size = (client->out_len + len) * 2;
+		out = realloc(client->out, size);
+		if (!out)
+			return -ENOMEM;
+
+		client->out = out;
+		client->out_size = size;
+	}
+
+	memcpy(client->out + client->out_len, buf, len);
+	client->out_len += len;
+	client_send(client);
+
+	return (ssize_t) len;
+}
+
+static ssize_t read_attr(void *priv, const char *device, const char *attr,
+			 char *buf, size_t len, enum iio_attr_type type)
+{
+	if (strcmp(device, "adc") && strcmp(device, "0"))
+		return -ENODEV;
+
+	if (type == IIO_ATTR_TYPE_DEVICE && !strcmp(attr, "sample_rate"))
+		return (ssize_t) snprintf(buf, len, "%u", sample_rate);
+
+	return -ENOENT;
+}
+
+static ssize_t write_attr(void *priv, const char *device, const char *attr,
+			  const char *buf, size_t len, enum iio_attr_type type)
+{
+	if (strcmp(device, "adc") && strcmp(device, "0"))
+		return -ENODEV;
+
+	if (type == IIO_ATTR_TYPE_DEVICE && !strcmp(attr, "sample_rate")) {
+		sample_rate = strtoul(buf, NULL, 10);
+		return (ssize_t) len;
+	}
+
+	return -ENOENT;
+}
+
+static ssize_t ch_read_attr(void *priv, const char *device,
+			    const char *channel, bool ch_out,
+			    const char *attr, char *buf, size_t len)
+{
+	uint32_t i;
+
+	if ((strcmp(device, "adc") && strcmp(device, "0")) || ch_out)
+		return -ENODEV;
+
+	if (!strcmp(channel, "voltage0"))
+		i = 0;
+	else if (!strcmp(channel, "voltage1"))
+		i = 1;
+	else
+		return -ENOENT;
+
+	if (!strcmp(attr, "raw"))
+		return (ssize_t) snprintf(buf, len, "%u", raw[i]++);
+	if (!strcmp(attr, "scale"))
+		return (ssize_t) snprintf(buf, len, "0.033");
+
+	return -ENOENT;
+}
+
+static ssize_t ch_write_attr(void *priv, const char *device,
+			     const char *channel, bool ch_out,
+			     const char *attr, const char *buf, size_t len)
+{
+	return -ENOSYS;
+}
+
+static bool is_adc(const char *device)
+{
+	return !strcmp(device, "adc") || !strcmp(device, "0");
+}
+
+static int32_t open_buffer(void *priv, const char *device, size_t sample_size,
+			   uint32_t mask, bool cyclic)
+{
+	struct client *client = priv;
+
+	if (!is_adc(device))
+		return -ENODEV;
+
+	client->opened = true;
+	client->mask = mask & 0x3;
+
+	return 0;
+}
+
+static int32_t close_buffer(void *priv, const char *device)
+{
+	struct client *client = priv;
+
+	if (!is_adc(device))
+		return -ENODEV;
+
+	client->opened = false;
+
+	return 0;
+}
+
+static int32_t get_mask(void *priv, const char *device, uint32_t *mask)
+{
+	struct client *client = priv;
+
+	if (!is_adc(device) || !client->opened)
+		return -ENODEV;
+
+	*mask = client->mask;
+
+	return 0;
+}
+
+/* The channels are sawtooth generators, one 16-bit sample per channel */
+static ssize_t read_data(void *priv, const char *device, char *buf,
+			 size_t offset, size_t bytes_count)
+{
+	struct client *client = priv;
+	size_t i;
+
+	if (!is_adc(device) || !client->opened)
+		return -ENODEV;
+
+	bytes_count &= ~(size_t) 1;
+	for (i = 0; i < bytes_count; i += 2, client->sample++)
+		memcpy(buf + i, &client->sample, 2);
+
+	return (ssize_t) bytes_count;
+}
+
+static const char * const xml =
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?><!DOCTYPE context [<!ELEMENT context "
+	"(device)*><!ELEMENT device (channel | attribute | debug-attribute | buffer-attribute)*><!ELEMENT "
+	"channel (scan-element?, attribute*)><!ELEMENT attribute EMPTY><!ELEMENT "
+	"scan-element EMPTY><!ELEMENT debug-attribute EMPTY><!ELEMENT buffer-attribute EMPTY><!ATTLIST context name "
+	"CDATA #REQUIRED description CDATA #IMPLIED><!ATTLIST device id CDATA "
+	"#REQUIRED name CDATA #IMPLIED><!ATTLIST channel id CDATA #REQUIRED type "
+	"(input|output) #REQUIRED name CDATA #IMPLIED><!ATTLIST scan-element index "
+	"CDATA #REQUIRED format CDATA #REQUIRED scale CDATA #IMPLIED><!ATTLIST "
+	"attribute name CDATA #REQUIRED filename CDATA #IMPLIED><!ATTLIST "
+	"debug-attribute name CDATA #REQUIRED><!ATTLIST buffer-attribute name "
+	"CDATA #REQUIRED value CDATA #IMPLIED>]><context name=\"tiny\" "
+	"description=\"Tiny IIOD server\" >"
+	"<device id=\"0\" name=\"adc\" >"
+	"<channel id=\"voltage0\" type=\"input\" >"
+	"<scan-element index=\"0\" format=\"le:u16/16&gt;&gt;0\" />"
+	"<attribute name=\"scale\" /><attribute name=\"raw\" /></channel>"
+	"<channel id=\"voltage1\" type=\"input\" >"
+	"<scan-element index=\"1\" format=\"le:u16/16&gt;&gt;0\" />"
+	"<attribute name=\"scale\" /><attribute name=\"raw\" /></channel>"
+	"<attribute name=\"sample_rate\" />"
+	"</device></context>";
+
+/* Shared by all the clients, never released */
+static ssize_t get_xml(void *priv, char **outxml)
+{
+	*outxml = (char *) xml;
+
+	return (ssize_t) strlen(xml);
+}
+
+static uint32_t get_time_us(void *priv)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint32_t) (ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static struct tinyiiod_ops_priv ops = {
+	.write = client_write,
+
+	.read_attr = read_attr,
+	.write_attr = write_attr,
+	.ch_read_attr = ch_read_attr,
+	.ch_write_attr = ch_write_attr,
+	.open = open_buffer,
+	.close = close_buffer,
+	.get_mask = get_mask,
+	.read_data = read_data,
+	.get_xml = get_xml,
+	.get_time_us = get_time_us,
+};
+
+static bool stop;
+
+static void quit_all(int sig)
+{
+	stop = true;
+}
+
+static int create_listener(uint16_t port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+		.sin_port = htons(port),
+	};
+	int fd, err, yes = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    listen(fd, SOMAXCONN) < 0) {
+		/* close() may overwrite errno */
+		err = errno;
+		close(fd);
+		return -err;
+	}
+
+	return fd;
+}
+
+static void accept_clients(int epfd, int listen_fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct client *client;
+	int fd, yes = 1;
+
+	for (;;) {
+		fd = accept4(listen_fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+		client = calloc(1, sizeof(*client));
+		if (!client) {
+			close(fd);
+			continue;
+		}
+
+		client->fd = fd;
+		client->iiod = tinyiiod_create_priv(&ops, client);
+		if (!client->iiod) {
+			free(client);
+			close(fd);
+			continue;
+		}
+
+		client->events = ev.events;
+		ev.data.ptr = client;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+}
+
+static void drop_client(int epfd, struct client *client)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	tinyiiod_destroy(client->iiod);
+	free(client->out);
+	free(client);
+}
+
+static void handle_client(int epfd, struct client *client, uint32_t events)
+{
+	struct epoll_event ev;
+	static char buf[0x10000];
+	bool streaming = false;
+	int32_t fed = 0;
+	ssize_t ret;
+
+	if (events & EPOLLOUT)
+		client_send(client);
+
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		ret = recv(client->fd, buf, sizeof(buf), 0);
+		if (ret > 0)
+			fed = tinyiiod_feed(client->iiod, buf, (size_t) ret);
+		else if (!ret || (errno != EAGAIN && errno != EINTR))
+			client->closed = true;
+
+		/* Without asynchronous transfers nothing is parked, so every
+		 * byte is consumed; anything else would have lost data */
+		if (fed && fed != -EAGAIN) {
+			fprintf(stderr, "Client %d: tinyiiod_feed(): %d\n",
+				client->fd, (int) fed);
+			client->closed = true;
+		}
+	}
+
+	if (client->closed) {
+		drop_client(epfd, client);
+		return;
+	}
+
+	/* Push the next block of a stream once the previous one is out */
+	if (!client->out_len)
+		streaming = tinyiiod_stream_step(client->iiod) > 0;
+
+	/* Don't take new commands before the previous answers are out */
+	if (client->out_len)
+		ev.events = EPOLLOUT;
+	else
+		ev.events = EPOLLIN | (streaming ? EPOLLOUT : 0);
+	if (ev.events != client->events) {
+		ev.data.ptr = client;
+		client->events = ev.events;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &ev);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_event ev = { .events = EPOLLIN }, events[MAX_EVENTS];
+	uint16_t port = SERVER_PORT;
+	struct client *client;
+	int epfd, listen_fd, i, nb;
+
+	if (argc > 1)
+		port = (uint16_t) strtoul(argv[1], NULL, 10);
+
+	signal(SIGINT, quit_all);
+	signal(SIGTERM, quit_all);
+
+	listen_fd = create_listener(port);
+	if (listen_fd < 0) {
+		fprintf(stderr, "Unable to listen on port %u: %s\n",
+			port, strerror(-listen_fd));
+		return EXIT_FAILURE;
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+	while (!stop) {
+		nb = epoll_wait(epfd, events, MAX_EVENTS, -1);
+
+		for (i = 0; i < nb; i++) {
+			client = events[i].data.ptr;
+			if (!client) {
+				accept_clients(epfd, listen_fd);
+				continue;
+			}
+
+			handle_client(epfd, client, events[i].events);
+		}
+	}
+
+	close(epfd);
+	close(listen_fd);
+
+	return EXIT_SUCCESS;
+}
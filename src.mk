@@ -1,4 +1,16 @@
 SRCS := $(ROOT)/parser.c			\
-	$(ROOT)/tinyiiod.c
+	$(ROOT)/tinyiiod.c			\
+	$(ROOT)/compress.c			\
+	$(ROOT)/scan.c				\
+	$(ROOT)/stats.c				\
+	$(ROOT)/context.c			\
+	$(ROOT)/legacy.c			\
+	$(ROOT)/xml.c
 
-UTESTS := example
+UTESTS := example				\
+	scan-test				\
+	compress-test				\
+	parser-test				\
+	legacy-test
+
+BENCH := bench
@@ -0,0 +1,194 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+#ifdef TINYIIOD_STATS
+
+static const char * const op_names[TINYIIOD_NB_OPCODES] = {
+	[TINYIIOD_OP_RESPONSE] = "UNKNOWN",
+	[TINYIIOD_OP_VERSION] = "VERSION",
+	[TINYIIOD_OP_PRINT] = "PRINT",
+	[TINYIIOD_OP_ZPRINT] = "ZPRINT",
+	[TINYIIOD_OP_READ] = "READ",
+	[TINYIIOD_OP_WRITE] = "WRITE",
+	[TINYIIOD_OP_OPEN] = "OPEN",
+	[TINYIIOD_OP_CLOSE] = "CLOSE",
+	[TINYIIOD_OP_READBUF] = "READBUF",
+	[TINYIIOD_OP_WRITEBUF] = "WRITEBUF",
+	[TINYIIOD_OP_TIMEOUT] = "TIMEOUT",
+	[TINYIIOD_OP_SET_BUFFERS_COUNT] = "SET",
+	[TINYIIOD_OP_GETTRIG] = "GETTRIG",
+	[TINYIIOD_OP_SETTRIG] = "SETTRIG",
+	[TINYIIOD_OP_EXIT] = "EXIT",
+	[TINYIIOD_OP_TEXT] = "TEXT",
+	[TINYIIOD_OP_STREAM] = "STREAM",
+	[TINYIIOD_OP_REARM] = "REARM",
+	[TINYIIOD_OP_STOP] = "STOP",
+};
+
+uint32_t tinyiiod_stats_time(struct tinyiiod *iiod)
+{
+	if (!iiod->ops->get_time_us)
+		return 0;
+
+	return iiod->ops->get_time_us(iiod->priv);
+}
+
+static void histogram_add(struct tinyiiod_histogram *histogram, uint32_t us)
+{
+	unsigned int i = 0;
+
+	while (us && i < TINYIIOD_STATS_BUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+
+	histogram->buckets[i]++;
+}
+
+void tinyiiod_stats_begin(struct tinyiiod *iiod)
+{
+	iiod->stats_op = TINYIIOD_OP_RESPONSE;
+	iiod->stats_start = tinyiiod_stats_time(iiod);
+	iiod->stats_parsed = iiod->stats_start;
+	iiod->stats_io = 0;
+	iiod->stats_timing = true;
+	iiod->stats_error = false;
+}
+
+void tinyiiod_stats_parsed(struct tinyiiod *iiod, enum tinyiiod_opcode op)
+{
+	if ((unsigned int) op < TINYIIOD_NB_OPCODES)
+		iiod->stats_op = op;
+	iiod->stats_parsed = tinyiiod_stats_time(iiod);
+}
+
+void tinyiiod_stats_end(struct tinyiiod *iiod, int32_t ret)
+{
+	struct tinyiiod_op_stats *stats = &iiod->stats.ops[iiod->stats_op];
+	uint32_t parse, backend;
+
+	/* Empty lines are not commands */
+	if (!iiod->stats_timing)
+		return;
+
+	iiod->stats_timing = false;
+
+	parse = iiod->stats_parsed - iiod->stats_start;
+	backend = tinyiiod_stats_time(iiod) - iiod->stats_parsed;
+	backend = backend > iiod->stats_io ? backend - iiod->stats_io : 0;
+
+	stats->count++;
+	if (ret < 0 || iiod->stats_error)
+		stats->errors++;
+
+	histogram_add(&stats->parse, parse);
+	histogram_add(&stats->backend, backend);
+	histogram_add(&stats->io, iiod->stats_io);
+}
+
+void tinyiiod_stats_io(struct tinyiiod *iiod, uint32_t start)
+{
+	iiod->stats_io += tinyiiod_stats_time(iiod) - start;
+}
+
+void tinyiiod_stats_bytes(struct tinyiiod *iiod, enum tinyiiod_opcode op,
+			  size_t bytes)
+{
+	iiod->stats.ops[op].bytes += bytes;
+}
+
+static size_t print_histogram(char *buf, size_t len, const char *name,
+			      const struct tinyiiod_histogram *histogram)
+{
+	size_t i, ret = 0;
+
+	ret += (size_t) snprintf(buf, len, " %s", name);
+
+	/* Only the buckets in use, as <bucket>:<count> */
+	for (i = 0; i < TINYIIOD_STATS_BUCKETS && ret < len; i++)
+		if (histogram->buckets[i])
+			ret += (size_t) snprintf(buf + ret, len - ret,
+						 " %u:%"PRIu32, (unsigned int) i,
+						 histogram->buckets[i]);
+
+	return ret;
+}
+
+/* One line per command used: name count errors bytes, then histograms */
+ssize_t tinyiiod_stats_print(struct tinyiiod *iiod, char *buf, size_t len)
+{
+	const struct tinyiiod_op_stats *stats;
+	size_t i, ret = 0;
+
+	if (!len)
+		return 0;
+
+	for (i = 0; i < TINYIIOD_NB_OPCODES && ret < len; i++) {
+		stats = &iiod->stats.ops[i];
+		if (!stats->count && !stats->bytes)
+			continue;
+
+		ret += (size_t) snprintf(buf + ret, len - ret,
+					 "%s %"PRIu32" %"PRIu32" %llu",
+					 op_names[i], stats->count,
+					 stats->errors, stats->bytes);
+		if (ret < len)
+			ret += print_histogram(buf + ret, len - ret, "parse",
+					       &stats->parse);
+		if (ret < len)
+			ret += print_histogram(buf + ret, len - ret, "backend",
+					       &stats->backend);
+		if (ret < len)
+			ret += print_histogram(buf + ret, len - ret, "io",
+					       &stats->io);
+		if (ret < len)
+			ret += (size_t) snprintf(buf + ret, len - ret, "\n");
+	}
+
+	if (ret < len)
+		ret += (size_t) snprintf(buf + ret, len - ret,
+					 "short_reads %"PRIu32"\n",
+					 iiod->stats.short_reads);
+
+	if (iiod->values && ret < len)
+		ret += (size_t) snprintf(buf + ret, len - ret,
+					 "value_cache %"PRIu32" %"PRIu32"\n",
+					 iiod->cache_stats.hits,
+					 iiod->cache_stats.misses);
+
+	/* Truncated: keep what fits */
+	if (ret >= len)
+		ret = len - 1;
+
+	return (ssize_t) ret;
+}
+
+const struct tinyiiod_stats *tinyiiod_get_stats(struct tinyiiod *iiod)
+{
+	return &iiod->stats;
+}
+
+void tinyiiod_reset_stats(struct tinyiiod *iiod)
+{
+	memset(&iiod->stats, 0, sizeof(iiod->stats));
+	memset(&iiod->cache_stats, 0, sizeof(iiod->cache_stats));
+}
+
+#endif /* TINYIIOD_STATS */
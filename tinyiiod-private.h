@@ -20,6 +20,287 @@
 
 #include "tinyiiod.h"
 
+#ifndef IIOD_RX_BUFFER_SIZE
+#define IIOD_RX_BUFFER_SIZE 256
+#endif
+
+#ifndef IIOD_TX_BUFFER_SIZE
+#define IIOD_TX_BUFFER_SIZE 512
+#endif
+
+#ifndef IIOD_LINE_SIZE
+#define IIOD_LINE_SIZE 128
+#endif
+
+#ifndef IIOD_ATTR_CACHE_SIZE
+#define IIOD_ATTR_CACHE_SIZE 16
+#endif
+
+#ifndef IIOD_VALUE_CACHE_SIZE
+#define IIOD_VALUE_CACHE_SIZE 16
+#endif
+
+#ifndef IIOD_VALUE_SIZE
+#define IIOD_VALUE_SIZE 32
+#endif
+
+#ifndef IIOD_ATTR_KEY_SIZE
+#define IIOD_ATTR_KEY_SIZE 64
+#endif
+
+#ifndef IIOD_DEVICE_NAME_SIZE
+#define IIOD_DEVICE_NAME_SIZE 32
+#endif
+
+#ifndef IIOD_MAX_SCAN_CHANNELS
+#define IIOD_MAX_SCAN_CHANNELS (TINYIIOD_MAX_MASK_WORDS * 32)
+#endif
+
+#ifndef IIOD_LZ_HASH_BITS
+#define IIOD_LZ_HASH_BITS 10
+#endif
+
+/* Hash table of the compressor */
+#define TINYIIOD_LZ_TABLE_SIZE	((1 << IIOD_LZ_HASH_BITS) * sizeof(uint32_t))
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+/* Room needed after packed scans, for the 16-byte vector stores */
+#define TINYIIOD_PACK_SLACK 16
+
+/* Identifies an attribute: type or direction, device, channel, name */
+struct tinyiiod_attr_key {
+	uint32_t hash;
+	char key[IIOD_ATTR_KEY_SIZE];
+	size_t len;
+};
+
+struct tinyiiod_attr_handle {
+	struct tinyiiod_attr_key key;
+	uint32_t handle;
+	uint32_t last_used;
+};
+
+struct tinyiiod_cached_value {
+	struct tinyiiod_attr_key key;
+	uint32_t last_used;
+	enum tinyiiod_cache_policy policy;
+	uint32_t ttl, stamp;
+	bool valid;
+	size_t len;
+	char value[IIOD_VALUE_SIZE];
+};
+
+enum tinyiiod_state {
+	TINYIIOD_STATE_IDLE,
+	TINYIIOD_STATE_WRITE_ATTR,
+	TINYIIOD_STATE_WRITEBUF,
+	/* READBUF or WRITEBUF waiting for tinyiiod_transfer_done() */
+	TINYIIOD_STATE_TRANSFER,
+};
+
+struct tinyiiod_mask {
+	uint32_t words[TINYIIOD_MAX_MASK_WORDS];
+	size_t nb_words;
+};
+
+/* Bytes of the enabled channels within a full scan, and where they go */
+struct tinyiiod_scan_run {
+	unsigned short src, dst, len;
+};
+
+struct tinyiiod_scan_layout {
+	bool valid;
+	char device[IIOD_DEVICE_NAME_SIZE];
+	struct tinyiiod_mask mask;
+
+	size_t scan_size, packed_size;
+	size_t nb_runs;
+	struct tinyiiod_scan_run runs[IIOD_MAX_SCAN_CHANNELS];
+
+	/* Byte shuffle packing vec_scans scans per 16-byte vector */
+	size_t vec_scans;
+	unsigned char shuffle[16];
+};
+
+/* Capture blocks submitted ahead of READBUF */
+struct tinyiiod_pipeline {
+	char device[IIOD_DEVICE_NAME_SIZE];
+	size_t bytes;
+	uint32_t count, queued;
+	uint32_t overruns;
+};
+
+/* Buffer pushed to the client without READBUF requests */
+struct tinyiiod_stream {
+	bool active;
+	char device[IIOD_DEVICE_NAME_SIZE];
+	struct tinyiiod_mask mask;
+	size_t bytes;
+	uint32_t seq;
+};
+
+/* Walk over the attributes of a device or channel in the context XML */
+struct tinyiiod_xml_attrs {
+	const char *ptr, *end;
+	const char *tag;
+	bool skip_channels;
+};
+
+/* Command waiting for its payload, when fed with tinyiiod_feed() */
+struct tinyiiod_pending {
+	enum tinyiiod_state state;
+	const char *device, *channel, *attr;
+	bool ch_out;
+	enum iio_attr_type type;
+	size_t bytes, offset;
+	/* Bytes of the current attribute chunk already in the buffer */
+	size_t fill;
+	int32_t ret;
+	/* Parked transfer: direction, and mask of the READBUF reply */
+	bool to_dev;
+	struct tinyiiod_mask mask;
+};
+
+struct tinyiiod {
+	struct tinyiiod_ops_priv *ops;
+	void *priv;
+
+	/* ops wrap the struct tinyiiod_ops in priv, see legacy.c */
+	bool legacy;
+	char *buf;
+	size_t buf_size;
+
+	/* Memory given to tinyiiod_init(), not allocated by the library */
+	bool static_mem;
+
+	/* Bytes pulled from the transport but not consumed yet */
+	char *rx_buf;
+	size_t rx_size, rx_pos, rx_len;
+
+	/* Command line (or binary frame); stays valid until the command is
+	 * complete */
+	char line[IIOD_LINE_SIZE];
+	size_t line_len;
+	bool line_overflow;
+	size_t skip;
+
+	/* Set while handling data passed to tinyiiod_feed() */
+	bool feeding;
+	struct tinyiiod_pending pending;
+
+	/* Response being built, sent once the command is done */
+	char *tx_buf;
+	size_t tx_size, tx_len;
+
+	/* Attribute handles, when the backend can resolve them */
+	struct tinyiiod_attr_handle *handles;
+	size_t nb_handles;
+	uint32_t handles_clock;
+
+	/* Static description of the context, if any */
+	const struct tinyiiod_context_desc *ctx;
+
+	/* Attribute values, when the backend sets a cache policy */
+	struct tinyiiod_cached_value *values;
+	size_t nb_values;
+	uint32_t values_clock;
+	struct tinyiiod_cache_stats cache_stats;
+
+	/* Context XML, as returned by ops->get_xml(), or generated from ctx
+	 * by the library when xml_generated is set */
+	char *xml;
+	size_t xml_len;
+	bool xml_generated;
+
+	/* Room for the generated and compressed XML of static instances,
+	 * and the hash table of the compressor */
+	char *xml_mem;
+	size_t xml_mem_size;
+	uint32_t *lz_table;
+
+	/* LZ4-compressed copy of the context XML, built on first use */
+	char *zxml;
+	size_t zxml_len;
+
+	/* READBUF pipeline, sized by SET BUFFERS_COUNT */
+	struct tinyiiod_pipeline pipe;
+	struct tinyiiod_stream stream;
+
+	/* Channels to extract, when the backend hands out full scans */
+	struct tinyiiod_scan_layout *layout;
+
+#ifdef TINYIIOD_STATS
+	struct tinyiiod_stats stats;
+
+	/* Command being timed */
+	enum tinyiiod_opcode stats_op;
+	uint32_t stats_start, stats_parsed, stats_io;
+	bool stats_timing, stats_error;
+#endif
+
+	/* Binary protocol enabled, and client of the current request */
+	bool binary;
+	unsigned char client_id;
+};
+
+static inline uint32_t tinyiiod_get_le32(const char *buf)
+{
+	const unsigned char *ptr = (const unsigned char *) buf;
+
+	return (uint32_t) ptr[0] | (uint32_t) ptr[1] << 8 |
+	       (uint32_t) ptr[2] << 16 | (uint32_t) ptr[3] << 24;
+}
+
+static inline void tinyiiod_put_le32(char *buf, uint32_t val)
+{
+	buf[0] = (char) val;
+	buf[1] = (char) (val >> 8);
+	buf[2] = (char) (val >> 16);
+	buf[3] = (char) (val >> 24);
+}
+
+/* Big-endian words, for the upstream iiod formats */
+static inline uint32_t tinyiiod_get_be32(const char *buf)
+{
+	const unsigned char *ptr = (const unsigned char *) buf;
+
+	return (uint32_t) ptr[0] << 24 | (uint32_t) ptr[1] << 16 |
+	       (uint32_t) ptr[2] << 8 | (uint32_t) ptr[3];
+}
+
+static inline void tinyiiod_put_be32(char *buf, uint32_t val)
+{
+	buf[0] = (char) (val >> 24);
+	buf[1] = (char) (val >> 16);
+	buf[2] = (char) (val >> 8);
+	buf[3] = (char) val;
+}
+
+#ifdef TINYIIOD_STATS
+uint32_t tinyiiod_stats_time(struct tinyiiod *iiod);
+void tinyiiod_stats_begin(struct tinyiiod *iiod);
+void tinyiiod_stats_parsed(struct tinyiiod *iiod, enum tinyiiod_opcode op);
+void tinyiiod_stats_end(struct tinyiiod *iiod, int32_t ret);
+void tinyiiod_stats_io(struct tinyiiod *iiod, uint32_t start);
+void tinyiiod_stats_bytes(struct tinyiiod *iiod, enum tinyiiod_opcode op,
+			  size_t bytes);
+ssize_t tinyiiod_stats_print(struct tinyiiod *iiod, char *buf, size_t len);
+
+#define tinyiiod_stats_error(iiod)	((iiod)->stats_error = true)
+#define tinyiiod_stats_short_read(iiod)	((iiod)->stats.short_reads++)
+#else
+/* Compiled out: no clock reads, no counters */
+#define tinyiiod_stats_time(iiod)		0
+#define tinyiiod_stats_begin(iiod)		do {} while (0)
+#define tinyiiod_stats_parsed(iiod, op)		do {} while (0)
+#define tinyiiod_stats_end(iiod, ret)		do {} while (0)
+#define tinyiiod_stats_io(iiod, start)		do { (void) (start); } while (0)
+#define tinyiiod_stats_bytes(iiod, op, bytes)	do {} while (0)
+#define tinyiiod_stats_error(iiod)		do {} while (0)
+#define tinyiiod_stats_short_read(iiod)		do {} while (0)
+#endif
+
 char tinyiiod_read_char(struct tinyiiod *iiod);
 ssize_t tinyiiod_read(struct tinyiiod *iiod, char *buf, size_t len);
 ssize_t tinyiiod_read_line(struct tinyiiod *iiod, char *buf, size_t len);
@@ -28,8 +309,47 @@ ssize_t tinyiiod_write_char(struct tinyiiod *iiod, char c);
 ssize_t tinyiiod_write(struct tinyiiod *iiod, const char *data, size_t len);
 ssize_t tinyiiod_write_string(struct tinyiiod *iiod, const char *str);
 ssize_t tinyiiod_write_value(struct tinyiiod *iiod, int32_t value);
+ssize_t tinyiiod_write_reply(struct tinyiiod *iiod, int32_t value, size_t len);
+ssize_t tinyiiod_write_eol(struct tinyiiod *iiod);
+ssize_t tinyiiod_write_mask(struct tinyiiod *iiod,
+			    const struct tinyiiod_mask *mask);
+ssize_t tinyiiod_flush(struct tinyiiod *iiod);
 
 void tinyiiod_write_xml(struct tinyiiod *iiod);
+void tinyiiod_write_compressed_xml(struct tinyiiod *iiod);
+
+size_t tinyiiod_compress_bound(size_t len);
+ssize_t tinyiiod_compress(const char *src, size_t len,
+			  char *dst, size_t dst_len, uint32_t *table);
+
+const char *tinyiiod_xml_find(const char *ptr, const char *end,
+			      const char *str);
+/* Value of the attribute name of the tag at tag, not NUL-terminated */
+const char *tinyiiod_xml_attr(const char *tag, const char *name, size_t *len);
+bool tinyiiod_xml_attr_is(const char *tag, const char *name,
+			  const char *value);
+/* Start of the device element, *end pointing past its end */
+const char *tinyiiod_xml_device(const char *xml, const char *device,
+				const char **end);
+int32_t tinyiiod_xml_attrs_init(struct tinyiiod_xml_attrs *it,
+				const char *xml, const char *device,
+				const char *channel, bool ch_out,
+				enum iio_attr_type type);
+/* Copy the name of the next attribute; returns its length, 0 at the end */
+ssize_t tinyiiod_xml_next_attr(struct tinyiiod_xml_attrs *it,
+			       char *name, size_t len);
+
+int32_t tinyiiod_scan_layout_init(struct tinyiiod_scan_layout *layout,
+				  const char *xml, const char *device,
+				  const struct tinyiiod_mask *mask,
+				  size_t buf_size);
+void tinyiiod_pack_scans(const struct tinyiiod_scan_layout *layout,
+			 char *dst, const char *src, size_t nb_scans);
+
+const struct tinyiiod_attr_desc *
+tinyiiod_context_attr(const struct tinyiiod_context_desc *ctx,
+		      const char *device, const char *channel, bool ch_out,
+		      const char *attr, enum iio_attr_type type);
 
 void tinyiiod_do_read_attr(struct tinyiiod *iiod, const char *device,
 			   const char *channel, bool ch_out, const char *attr, enum iio_attr_type type);
@@ -37,27 +357,46 @@ void tinyiiod_do_read_attr(struct tinyiiod *iiod, const char *device,
 void tinyiiod_do_write_attr(struct tinyiiod *iiod, const char *device,
 			    const char *channel, bool ch_out, const char *attr,
 			    size_t bytes, enum iio_attr_type type);
+size_t tinyiiod_attr_chunk_len(struct tinyiiod *iiod);
+void tinyiiod_write_attr_chunk(struct tinyiiod *iiod, size_t len);
 
 void tinyiiod_do_open(struct tinyiiod *iiod, const char *device,
-		      size_t sample_size, uint32_t mask, bool cyclic);
+		      size_t sample_size, const struct tinyiiod_mask *mask,
+		      bool cyclic);
 void tinyiiod_do_close(struct tinyiiod *iiod, const char *device);
 
 int32_t tinyiiod_do_open_instance(struct tinyiiod *iiod);
 
 int32_t tinyiiod_do_close_instance(struct tinyiiod *iiod);
 
+int32_t tinyiiod_do_stream(struct tinyiiod *iiod,
+			   const char *device, size_t bytes_count);
+int32_t tinyiiod_do_stop(struct tinyiiod *iiod, const char *device);
 int32_t tinyiiod_do_readbuf(struct tinyiiod *iiod,
 			    const char *device, size_t bytes_count);
 
 int32_t tinyiiod_do_writebuf(struct tinyiiod *iiod, const char *device,
 			     size_t bytes_count);
+int32_t tinyiiod_writebuf_done(struct tinyiiod *iiod, const char *device,
+			       size_t bytes_count, int32_t ret);
+int32_t tinyiiod_do_rearm(struct tinyiiod *iiod, const char *device);
 
 int32_t tinyiiod_do_gettrig(struct tinyiiod *iiod, const char *device);
 
 int32_t tinyiiod_do_settrig(struct tinyiiod *iiod, const char *device,
 			    char *trigger_name, size_t bytes_count);
 
+struct tinyiiod_command {
+	const char *name;
+	int32_t (*handler)(struct tinyiiod *iiod, char *str);
+	enum tinyiiod_opcode op;
+};
+
+/* Text command called name, len bytes long; NULL if there is none */
+const struct tinyiiod_command *
+tinyiiod_find_command(const char *name, size_t len);
 int32_t tinyiiod_parse_string(struct tinyiiod *iiod, char *str);
+int32_t tinyiiod_parse_frame(struct tinyiiod *iiod, char *frame);
 
 int32_t tinyiiod_set_timeout(struct tinyiiod *iiod, uint32_t timeout);
 
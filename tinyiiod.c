@@ -19,263 +19,2229 @@
 
 #include "compat.h"
 
-struct tinyiiod {
-	struct tinyiiod_ops *ops;
+/* Keeps the arrays carved out of the instance memory aligned */
+#define TINYIIOD_MEM_ALIGN	8
+
+static size_t tinyiiod_mem_align(size_t size)
+{
+	return (size + TINYIIOD_MEM_ALIGN - 1) & ~(size_t) (TINYIIOD_MEM_ALIGN - 1);
+}
+
+/* Sizes of the configuration, build defaults where it has none */
+static void tinyiiod_get_config(const struct tinyiiod_config *config,
+				struct tinyiiod_config *cfg)
+{
+	if (config)
+		*cfg = *config;
+	else
+		memset(cfg, 0, sizeof(*cfg));
+
+	if (!cfg->buffer_size)
+		cfg->buffer_size = IIOD_BUFFER_SIZE;
+	if (!cfg->rx_size)
+		cfg->rx_size = IIOD_RX_BUFFER_SIZE;
+	if (!cfg->tx_size)
+		cfg->tx_size = IIOD_TX_BUFFER_SIZE;
+	if (!cfg->attr_cache_size)
+		cfg->attr_cache_size = IIOD_ATTR_CACHE_SIZE;
+	if (!cfg->value_cache_size)
+		cfg->value_cache_size = IIOD_VALUE_CACHE_SIZE;
+}
+
+size_t tinyiiod_mem_size(const struct tinyiiod_ops_priv *ops,
+			 const struct tinyiiod_config *config)
+{
+	size_t size = tinyiiod_mem_align(sizeof(struct tinyiiod));
+	struct tinyiiod_config cfg;
+
+	tinyiiod_get_config(config, &cfg);
+
+	if (ops->resolve_attr)
+		size += tinyiiod_mem_align(cfg.attr_cache_size *
+					   sizeof(struct tinyiiod_attr_handle));
+	if (ops->get_cache_policy)
+		size += tinyiiod_mem_align(cfg.value_cache_size *
+					   sizeof(struct tinyiiod_cached_value));
+	if (ops->get_scans_ptr)
+		size += tinyiiod_mem_align(sizeof(struct tinyiiod_scan_layout));
+	if (cfg.xml_size)
+		size += TINYIIOD_LZ_TABLE_SIZE + tinyiiod_mem_align(cfg.xml_size);
+
+	return size + cfg.buffer_size + cfg.rx_size + cfg.tx_size;
+}
+
+struct tinyiiod * tinyiiod_init(void *mem, size_t len,
+				struct tinyiiod_ops_priv *ops, void *priv,
+				const struct tinyiiod_config *config)
+{
+	struct tinyiiod *iiod = mem;
+	struct tinyiiod_config cfg;
+	char *ptr = mem;
+	size_t size;
+
+	tinyiiod_get_config(config, &cfg);
+
+	if (!mem || (size_t) mem % TINYIIOD_MEM_ALIGN ||
+	    len < tinyiiod_mem_size(ops, &cfg) ||
+	    cfg.buffer_size < TINYIIOD_MIN_BUFFER_SIZE)
+		return NULL;
+
+	memset(iiod, 0, sizeof(*iiod));
+	ptr += tinyiiod_mem_align(sizeof(*iiod));
+
+	if (ops->resolve_attr) {
+		size = cfg.attr_cache_size * sizeof(*iiod->handles);
+		memset(ptr, 0, size);
+		iiod->handles = (struct tinyiiod_attr_handle *) ptr;
+		iiod->nb_handles = cfg.attr_cache_size;
+		ptr += tinyiiod_mem_align(size);
+	}
+
+	if (ops->get_cache_policy) {
+		size = cfg.value_cache_size * sizeof(*iiod->values);
+		memset(ptr, 0, size);
+		iiod->values = (struct tinyiiod_cached_value *) ptr;
+		iiod->nb_values = cfg.value_cache_size;
+		ptr += tinyiiod_mem_align(size);
+	}
+
+	if (ops->get_scans_ptr) {
+		memset(ptr, 0, sizeof(*iiod->layout));
+		iiod->layout = (struct tinyiiod_scan_layout *) ptr;
+		ptr += tinyiiod_mem_align(sizeof(*iiod->layout));
+	}
+
+	if (cfg.xml_size) {
+		iiod->lz_table = (uint32_t *) ptr;
+		ptr += TINYIIOD_LZ_TABLE_SIZE;
+
+		iiod->xml_mem = ptr;
+		iiod->xml_mem_size = cfg.xml_size;
+		ptr += tinyiiod_mem_align(cfg.xml_size);
+	}
+
+	iiod->buf = ptr;
+	iiod->buf_size = cfg.buffer_size;
+	ptr += cfg.buffer_size;
+
+	iiod->rx_buf = ptr;
+	iiod->rx_size = cfg.rx_size;
+	ptr += cfg.rx_size;
+
+	iiod->tx_buf = ptr;
+	iiod->tx_size = cfg.tx_size;
+
+	iiod->ops = ops;
+	iiod->priv = priv;
+	iiod->static_mem = true;
+
+	return iiod;
+}
+
+struct tinyiiod * tinyiiod_create_priv(struct tinyiiod_ops_priv *ops,
+				       void *priv)
+{
+	size_t len = tinyiiod_mem_size(ops, NULL);
+	struct tinyiiod *iiod;
+	void *mem;
+
+	/* Everything in one block */
+	mem = malloc(len);
+	if (!mem)
+		return NULL;
+
+	iiod = tinyiiod_init(mem, len, ops, priv, NULL);
+	if (!iiod) {
+		free(mem);
+		return NULL;
+	}
+
+	iiod->static_mem = false;
+
+	return iiod;
+}
+
+void tinyiiod_destroy(struct tinyiiod *iiod)
+{
+	tinyiiod_invalidate_xml(iiod);
+
+	if (iiod->legacy)
+		free(iiod->ops);
+
+	if (!iiod->static_mem)
+		free(iiod);
+}
+
+static int32_t tinyiiod_read_exact(struct tinyiiod *iiod, char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = tinyiiod_read(iiod, buf, len);
+		if (ret <= 0)
+			return ret < 0 ? (int32_t) ret : -EIO;
+
+		buf += ret;
+		len -= (size_t) ret;
+	}
+
+	return 0;
+}
+
+static int32_t tinyiiod_read_frame(struct tinyiiod *iiod)
+{
+	size_t len, bytes;
+	int32_t ret;
+
+	ret = tinyiiod_read_exact(iiod, iiod->line,
+				  TINYIIOD_BINARY_HEADER_SIZE);
+	if (ret < 0)
+		return ret;
+
+	len = tinyiiod_get_le32(iiod->line + 4);
+	if (len >= sizeof(iiod->line) - TINYIIOD_BINARY_HEADER_SIZE) {
+		/* Arguments can't be that long -> drop them */
+		for (; len; len -= bytes) {
+			bytes = len > iiod->buf_size ? iiod->buf_size : len;
+			ret = tinyiiod_read_exact(iiod, iiod->buf, bytes);
+			if (ret < 0)
+				return ret;
+		}
+
+		return -EINVAL;
+	}
+
+	ret = tinyiiod_read_exact(iiod,
+				  iiod->line + TINYIIOD_BINARY_HEADER_SIZE, len);
+	if (ret < 0)
+		return ret;
+
+	iiod->line[TINYIIOD_BINARY_HEADER_SIZE + len] = '\0';
+
+	return tinyiiod_parse_frame(iiod, iiod->line);
+}
+
+int32_t tinyiiod_read_command(struct tinyiiod *iiod)
+{
+	int32_t ret;
+
+	/* Push the stream until the client has something to say */
+	while (iiod->stream.active && iiod->rx_pos == iiod->rx_len &&
+	       !iiod->ops->read_ready(iiod->priv))
+		tinyiiod_stream_step(iiod);
+
+	if (iiod->binary)
+		return tinyiiod_read_frame(iiod);
+
+	ret = tinyiiod_read_line(iiod, iiod->line, sizeof(iiod->line));
+	if (ret < 0)
+		return ret;
+
+	return tinyiiod_parse_string(iiod, iiod->line);
+}
+
+static size_t tinyiiod_feed_line(struct tinyiiod *iiod,
+				 const char *data, size_t len)
+{
+	const char *eol = memchr(data, '\n', len);
+	size_t bytes = eol ? (size_t) (eol - data) : len;
+
+	if (iiod->line_len + bytes >= sizeof(iiod->line)) {
+		/* No \n in sight -> garbage data, drop the whole line */
+		iiod->line_overflow = true;
+		iiod->line_len = 0;
+	} else if (!iiod->line_overflow) {
+		memcpy(iiod->line + iiod->line_len, data, bytes);
+		iiod->line_len += bytes;
+	}
+
+	if (!eol)
+		return bytes;
+
+	if (!iiod->line_overflow) {
+		if (iiod->line_len && iiod->line[iiod->line_len - 1] == '\r')
+			iiod->line_len--;
+		iiod->line[iiod->line_len] = '\0';
+
+		tinyiiod_parse_string(iiod, iiod->line);
+	}
+
+	iiod->line_len = 0;
+	iiod->line_overflow = false;
+
+	return bytes + 1;
+}
+
+static size_t tinyiiod_feed_frame(struct tinyiiod *iiod,
+				  const char *data, size_t len)
+{
+	size_t bytes, args, need = TINYIIOD_BINARY_HEADER_SIZE;
+
+	if (iiod->skip) {
+		bytes = len < iiod->skip ? len : iiod->skip;
+		iiod->skip -= bytes;
+		return bytes;
+	}
+
+	/* Bounded when the header came in, see below */
+	if (iiod->line_len >= need)
+		need += tinyiiod_get_le32(iiod->line + 4);
+
+	bytes = need - iiod->line_len;
+	if (bytes > len)
+		bytes = len;
+
+	memcpy(iiod->line + iiod->line_len, data, bytes);
+	iiod->line_len += bytes;
+
+	if (iiod->line_len != TINYIIOD_BINARY_HEADER_SIZE &&
+	    iiod->line_len < need)
+		return bytes;
+
+	if (iiod->line_len == TINYIIOD_BINARY_HEADER_SIZE) {
+		/* Checked before the addition, which could wrap around on
+		 * 32-bit targets */
+		args = tinyiiod_get_le32(iiod->line + 4);
+		if (args >= sizeof(iiod->line) - TINYIIOD_BINARY_HEADER_SIZE) {
+			/* Arguments can't be that long -> drop them */
+			iiod->skip = args;
+			iiod->line_len = 0;
+			return bytes;
+		}
+
+		need += args;
+		if (iiod->line_len < need)
+			return bytes;
+	}
+
+	iiod->line[iiod->line_len] = '\0';
+	iiod->line_len = 0;
+
+	tinyiiod_parse_frame(iiod, iiod->line);
+
+	return bytes;
+}
+
+static size_t tinyiiod_feed_attr(struct tinyiiod *iiod,
+				 const char *data, size_t len)
+{
+	struct tinyiiod_pending *p = &iiod->pending;
+	size_t chunk = tinyiiod_attr_chunk_len(iiod);
+	size_t bytes = chunk - p->fill;
+
+	if (bytes > len)
+		bytes = len;
+
+	memcpy(iiod->buf + p->fill, data, bytes);
+	p->fill += bytes;
+
+	if (p->fill == chunk) {
+		p->fill = 0;
+		tinyiiod_write_attr_chunk(iiod, chunk);
+		if (p->state == TINYIIOD_STATE_IDLE)
+			tinyiiod_flush(iiod);
+	}
+
+	return bytes;
+}
+
+static size_t tinyiiod_feed_buf(struct tinyiiod *iiod,
+				const char *data, size_t len)
+{
+	struct tinyiiod_pending *p = &iiod->pending;
+	size_t bytes = p->bytes - p->offset, done = 0;
+	ssize_t ret;
 	char *buf;
-};
 
-struct tinyiiod * tinyiiod_create(struct tinyiiod_ops *ops)
+	if (bytes > len)
+		bytes = len;
+
+	/* After an error, the rest of the payload is only drained */
+	while (p->ret >= 0 && done < bytes) {
+		if (iiod->ops->get_write_ptr) {
+			ret = iiod->ops->get_write_ptr(iiod->priv, p->device,
+						       &buf, p->offset + done,
+						       bytes - done);
+			if (ret > 0)
+				memcpy(buf, data + done, (size_t) ret);
+		} else {
+			ret = iiod->ops->write_data(iiod->priv, p->device,
+						    data + done,
+						    p->offset + done,
+						    bytes - done);
+		}
+		if (ret <= 0)
+			p->ret = ret < 0 ? (int32_t) ret : -EIO;
+		else
+			done += (size_t) ret;
+	}
+	p->offset += bytes;
+
+	if (p->offset == p->bytes) {
+		p->state = TINYIIOD_STATE_IDLE;
+		tinyiiod_writebuf_done(iiod, p->device, p->bytes, p->ret);
+		tinyiiod_flush(iiod);
+	}
+
+	return bytes;
+}
+
+/* Keep the data coming while a transfer is parked, for later. What doesn't
+ * fit is left to the caller, done being what was consumed before. */
+static int32_t tinyiiod_stash(struct tinyiiod *iiod, const char *data,
+			      size_t len, size_t done)
+{
+	size_t room = iiod->rx_size - iiod->rx_len;
+
+	if (len <= room) {
+		memmove(iiod->rx_buf + iiod->rx_len, data, len);
+		iiod->rx_len += len;
+		return -EBUSY;
+	}
+
+	memmove(iiod->rx_buf + iiod->rx_len, data, room);
+	iiod->rx_len += room;
+	done += room;
+
+	return done ? (int32_t) done : -ENOSPC;
+}
+
+int32_t tinyiiod_feed(struct tinyiiod *iiod, const char *data, size_t len)
+{
+	size_t bytes, done = 0;
+
+	if (iiod->pending.state == TINYIIOD_STATE_TRANSFER)
+		return tinyiiod_stash(iiod, data, len, 0);
+
+	iiod->feeding = true;
+
+	while (len) {
+		switch (iiod->pending.state) {
+		case TINYIIOD_STATE_TRANSFER:
+			iiod->feeding = false;
+			return tinyiiod_stash(iiod, data, len, done);
+		case TINYIIOD_STATE_WRITE_ATTR:
+			bytes = tinyiiod_feed_attr(iiod, data, len);
+			break;
+		case TINYIIOD_STATE_WRITEBUF:
+			bytes = tinyiiod_feed_buf(iiod, data, len);
+			break;
+		default:
+			if (iiod->binary)
+				bytes = tinyiiod_feed_frame(iiod, data, len);
+			else
+				bytes = tinyiiod_feed_line(iiod, data, len);
+			break;
+		}
+
+		data += bytes;
+		len -= bytes;
+		done += bytes;
+	}
+
+	iiod->feeding = false;
+
+	if (iiod->pending.state == TINYIIOD_STATE_TRANSFER)
+		return -EBUSY;
+	if (iiod->pending.state != TINYIIOD_STATE_IDLE ||
+	    iiod->line_len || iiod->skip)
+		return -EAGAIN;
+
+	return 0;
+}
+
+/* Transport calls, timed for the statistics */
+static ssize_t tinyiiod_io_read(struct tinyiiod *iiod, char *buf, size_t len)
+{
+	uint32_t start = tinyiiod_stats_time(iiod);
+	ssize_t ret = iiod->ops->read(iiod->priv, buf, len);
+
+	tinyiiod_stats_io(iiod, start);
+
+	return ret;
+}
+
+static ssize_t tinyiiod_io_write(struct tinyiiod *iiod,
+				 const char *buf, size_t len)
+{
+	uint32_t start = tinyiiod_stats_time(iiod);
+	ssize_t ret = iiod->ops->write(iiod->priv, buf, len);
+
+	tinyiiod_stats_io(iiod, start);
+
+	return ret;
+}
+
+static ssize_t tinyiiod_fill_rx(struct tinyiiod *iiod)
+{
+	uint32_t start;
+	ssize_t ret;
+
+	iiod->rx_pos = 0;
+	iiod->rx_len = 0;
+
+	/* The client may be waiting for our answer before sending more */
+	tinyiiod_flush(iiod);
+
+	if (iiod->ops->read_avail) {
+		start = tinyiiod_stats_time(iiod);
+		ret = iiod->ops->read_avail(iiod->priv, iiod->rx_buf,
+					    iiod->rx_size);
+		tinyiiod_stats_io(iiod, start);
+	} else {
+		ret = tinyiiod_io_read(iiod, iiod->rx_buf, 1);
+	}
+	if (ret <= 0)
+		return ret < 0 ? ret : -EIO;
+
+	iiod->rx_len = (size_t) ret;
+
+	return ret;
+}
+
+ssize_t tinyiiod_read(struct tinyiiod *iiod, char *buf, size_t len)
+{
+	size_t avail = iiod->rx_len - iiod->rx_pos;
+	ssize_t ret;
+
+	if (!avail) {
+		tinyiiod_flush(iiod);
+		return tinyiiod_io_read(iiod, buf, len);
+	}
+
+	/* Hand out what the line reader already pulled in first */
+	if (avail > len)
+		avail = len;
+
+	memcpy(buf, iiod->rx_buf + iiod->rx_pos, avail);
+	iiod->rx_pos += avail;
+
+	if (avail == len)
+		return (ssize_t) len;
+
+	tinyiiod_flush(iiod);
+	ret = tinyiiod_io_read(iiod, buf + avail, len - avail);
+	if (ret < 0)
+		return (ssize_t) avail;
+
+	return (ssize_t) avail + ret;
+}
+
+ssize_t tinyiiod_read_line(struct tinyiiod *iiod, char *buf, size_t len)
+{
+	size_t i = 0, bytes;
+	char *start, *eol;
+	ssize_t ret;
+
+	if (iiod->ops->read_line)
+		return iiod->ops->read_line(iiod->priv, buf, len);
+
+	for (;;) {
+		if (iiod->rx_pos == iiod->rx_len) {
+			ret = tinyiiod_fill_rx(iiod);
+			if (ret < 0)
+				return -EIO;
+		}
+
+		start = iiod->rx_buf + iiod->rx_pos;
+		bytes = iiod->rx_len - iiod->rx_pos;
+
+		/* Skip the empty lines in front of the command */
+		if (!i) {
+			while (bytes && (*start == '\n' || *start == '\r')) {
+				start++;
+				bytes--;
+				iiod->rx_pos++;
+			}
+			if (!bytes)
+				continue;
+		}
+
+		eol = memchr(start, '\n', bytes);
+		if (eol)
+			bytes = (size_t) (eol - start);
+
+		if (i + bytes > len - 1) {
+			/* No \n found -> garbage data */
+			iiod->rx_pos += len - 1 - i;
+			return -EIO;
+		}
+
+		memcpy(buf + i, start, bytes);
+		i += bytes;
+		iiod->rx_pos += bytes;
+
+		if (eol) {
+			iiod->rx_pos++;
+			break;
+		}
+	}
+
+	if (i && buf[i - 1] == '\r')
+		i--;
+	buf[i] = '\0';
+
+	return i;
+}
+
+ssize_t tinyiiod_write_char(struct tinyiiod *iiod, char c)
+{
+	return tinyiiod_write(iiod, &c, 1);
+}
+
+ssize_t tinyiiod_flush(struct tinyiiod *iiod)
+{
+	ssize_t ret;
+
+	if (!iiod->tx_len)
+		return 0;
+
+	ret = tinyiiod_io_write(iiod, iiod->tx_buf, iiod->tx_len);
+	iiod->tx_len = 0;
+
+	return ret;
+}
+
+ssize_t tinyiiod_write(struct tinyiiod *iiod, const char *data, size_t len)
+{
+	struct tinyiiod_iovec iov[2];
+	uint32_t start;
+	ssize_t ret;
+
+	if (len > iiod->tx_size - iiod->tx_len) {
+		if (len >= iiod->tx_size && iiod->ops->writev) {
+			/* Send the staged header and the payload together */
+			iov[0].buf = iiod->tx_buf;
+			iov[0].len = iiod->tx_len;
+			iov[1].buf = data;
+			iov[1].len = len;
+
+			start = tinyiiod_stats_time(iiod);
+			ret = iiod->ops->writev(iiod->priv, iov, 2);
+			tinyiiod_stats_io(iiod, start);
+			iiod->tx_len = 0;
+
+			return ret < 0 ? ret : (ssize_t) len;
+		}
+
+		ret = tinyiiod_flush(iiod);
+		if (ret < 0)
+			return ret;
+
+		/* Too big to be staged: no point in copying it */
+		if (len >= iiod->tx_size)
+			return tinyiiod_io_write(iiod, data, len);
+	}
+
+	memcpy(iiod->tx_buf + iiod->tx_len, data, len);
+	iiod->tx_len += len;
+
+	return (ssize_t) len;
+}
+
+ssize_t tinyiiod_write_string(struct tinyiiod *iiod, const char *str)
+{
+	return tinyiiod_write(iiod, str, strlen(str));
+}
+
+/* Send a status or length, followed by len bytes of data */
+static ssize_t tinyiiod_write_header(struct tinyiiod *iiod,
+				     enum tinyiiod_opcode op,
+				     int32_t value, size_t len)
+{
+	char buf[TINYIIOD_BINARY_HEADER_SIZE + 4];
+
+	if (value < 0)
+		tinyiiod_stats_error(iiod);
+
+	if (!iiod->binary) {
+		snprintf(buf, sizeof(buf), "%"PRIi32"\n", value);
+		return tinyiiod_write_string(iiod, buf);
+	}
+
+	buf[0] = (char) op;
+	buf[1] = (char) iiod->client_id;
+	buf[2] = 0;
+	buf[3] = 0;
+	tinyiiod_put_le32(buf + 4, (uint32_t) len);
+	tinyiiod_put_le32(buf + 8, (uint32_t) value);
+
+	return tinyiiod_write(iiod, buf, TINYIIOD_BINARY_HEADER_SIZE);
+}
+
+ssize_t tinyiiod_write_reply(struct tinyiiod *iiod, int32_t value, size_t len)
+{
+	return tinyiiod_write_header(iiod, TINYIIOD_OP_RESPONSE, value, len);
+}
+
+ssize_t tinyiiod_write_value(struct tinyiiod *iiod, int32_t value)
+{
+	return tinyiiod_write_reply(iiod, value, 0);
+}
+
+/* Data that follows a reply is newline-terminated in text mode only */
+ssize_t tinyiiod_write_eol(struct tinyiiod *iiod)
+{
+	if (iiod->binary)
+		return 0;
+
+	return tinyiiod_write_char(iiod, '\n');
+}
+
+ssize_t tinyiiod_write_mask(struct tinyiiod *iiod,
+			    const struct tinyiiod_mask *mask)
+{
+	char buf[TINYIIOD_MAX_MASK_WORDS * 8 + 2];
+	size_t i, len = 0;
+
+	if (iiod->binary) {
+		for (i = 0; i < mask->nb_words; i++)
+			tinyiiod_put_le32(buf + i * 4, mask->words[i]);
+
+		return tinyiiod_write(iiod, buf, mask->nb_words * 4);
+	}
+
+	for (i = mask->nb_words; i > 0; i--)
+		len += (size_t) snprintf(buf + len, sizeof(buf) - len,
+					 "%08"PRIx32, mask->words[i - 1]);
+	buf[len++] = '\n';
+
+	return tinyiiod_write(iiod, buf, len);
+}
+
+static int32_t tinyiiod_get_mask(struct tinyiiod *iiod, const char *device,
+				 struct tinyiiod_mask *mask)
+{
+	int32_t ret;
+
+	if (!iiod->ops->get_mask_words) {
+		mask->nb_words = 1;
+		return iiod->ops->get_mask(iiod->priv, device, mask->words);
+	}
+
+	mask->nb_words = TINYIIOD_MAX_MASK_WORDS;
+	ret = iiod->ops->get_mask_words(iiod->priv, device, mask->words,
+					&mask->nb_words);
+	if (ret >= 0 && (!mask->nb_words ||
+			 mask->nb_words > TINYIIOD_MAX_MASK_WORDS))
+		ret = -EINVAL;
+
+	return ret;
+}
+
+/* Bytes taken by the mask in a binary reply */
+static size_t tinyiiod_mask_size(struct tinyiiod *iiod,
+				 const struct tinyiiod_mask *mask)
+{
+	return iiod->binary ? mask->nb_words * 4 : 0;
+}
+
+uint32_t tinyiiod_get_overruns(struct tinyiiod *iiod)
+{
+	return iiod->pipe.overruns;
+}
+
+void tinyiiod_invalidate_xml(struct tinyiiod *iiod)
+{
+	if (iiod->layout)
+		iiod->layout->valid = false;
+
+	/* Attributes may have been renamed, added or removed */
+	if (iiod->handles)
+		memset(iiod->handles, 0,
+		       iiod->nb_handles * sizeof(*iiod->handles));
+
+	/* The XML of get_xml() stays the backend's; static instances keep
+	 * theirs in xml_mem */
+	if (iiod->xml && !iiod->xml_generated) {
+		if (iiod->ops->release_xml)
+			iiod->ops->release_xml(iiod->priv, iiod->xml);
+	} else if (!iiod->static_mem) {
+		free(iiod->xml);
+	}
+	if (!iiod->static_mem)
+		free(iiod->zxml);
+
+	iiod->zxml = NULL;
+	iiod->zxml_len = 0;
+
+	iiod->xml = NULL;
+	iiod->xml_len = 0;
+	iiod->xml_generated = false;
+}
+
+static ssize_t tinyiiod_get_xml(struct tinyiiod *iiod)
+{
+	char *xml = NULL;
+	size_t len;
+	ssize_t ret;
+
+	if (iiod->xml)
+		return (ssize_t) iiod->xml_len;
+
+	/* Generated from the context description, sized by a first pass */
+	if (iiod->ctx) {
+		len = tinyiiod_context_xml(iiod->ctx, NULL, 0);
+		if (!iiod->static_mem)
+			xml = malloc(len + 1);
+		else if (len < iiod->xml_mem_size)
+			xml = iiod->xml_mem;
+		else
+			return -ENOSPC;
+		if (!xml)
+			return -ENOMEM;
+
+		iiod->xml = xml;
+		iiod->xml_len = tinyiiod_context_xml(iiod->ctx, xml, len + 1);
+		iiod->xml_generated = true;
+
+		return (ssize_t) iiod->xml_len;
+	}
+
+	if (!iiod->ops->get_xml)
+		return -ENOSYS;
+
+	ret = iiod->ops->get_xml(iiod->priv, &xml);
+	if (ret < 0)
+		return ret;
+	if (!xml)
+		return -ENOENT;
+
+	iiod->xml = xml;
+	iiod->xml_len = ret > 0 ? (size_t) ret : strlen(xml);
+
+	return (ssize_t) iiod->xml_len;
+}
+
+void tinyiiod_write_xml(struct tinyiiod *iiod)
+{
+	ssize_t ret = tinyiiod_get_xml(iiod);
+
+	if (ret < 0) {
+		tinyiiod_write_value(iiod, (int32_t) ret);
+		return;
+	}
+
+	tinyiiod_write_reply(iiod, (int32_t) ret, iiod->xml_len);
+	tinyiiod_write(iiod, iiod->xml, iiod->xml_len);
+	tinyiiod_write_eol(iiod);
+}
+
+static ssize_t tinyiiod_get_compressed_xml(struct tinyiiod *iiod)
+{
+	size_t len;
+	ssize_t ret;
+	char *zxml;
+
+	if (iiod->zxml)
+		return (ssize_t) iiod->zxml_len;
+
+	ret = tinyiiod_get_xml(iiod);
+	if (ret < 0)
+		return ret;
+
+	/* Static instances compress after the generated XML, if any */
+	if (iiod->static_mem) {
+		len = iiod->xml_generated ? iiod->xml_len + 1 : 0;
+		if (len >= iiod->xml_mem_size)
+			return -ENOSPC;
+
+		zxml = iiod->xml_mem + len;
+		len = iiod->xml_mem_size - len;
+	} else {
+		len = tinyiiod_compress_bound(iiod->xml_len);
+		zxml = malloc(len);
+		if (!zxml)
+			return -ENOMEM;
+	}
+
+	ret = tinyiiod_compress(iiod->xml, iiod->xml_len, zxml, len,
+				iiod->lz_table);
+	if (ret < 0) {
+		if (!iiod->static_mem)
+			free(zxml);
+		return ret;
+	}
+
+	iiod->zxml = zxml;
+	iiod->zxml_len = (size_t) ret;
+
+	return ret;
+}
+
+/* Same as PRINT, with the LZ4-compressed size preceding the actual size */
+void tinyiiod_write_compressed_xml(struct tinyiiod *iiod)
+{
+	ssize_t ret = tinyiiod_get_compressed_xml(iiod);
+
+	if (ret < 0) {
+		tinyiiod_write_value(iiod, (int32_t) ret);
+		return;
+	}
+
+	if (iiod->binary) {
+		tinyiiod_write_reply(iiod, (int32_t) iiod->xml_len,
+				     iiod->zxml_len);
+	} else {
+		tinyiiod_write_value(iiod, (int32_t) ret);
+		tinyiiod_write_value(iiod, (int32_t) iiod->xml_len);
+	}
+
+	tinyiiod_write(iiod, iiod->zxml, iiod->zxml_len);
+	tinyiiod_write_eol(iiod);
+}
+
+static bool key_append(struct tinyiiod_attr_key *key, const char *str)
+{
+	/* Keep the terminating NUL: it separates the tokens */
+	do {
+		if (key->len == IIOD_ATTR_KEY_SIZE)
+			return false;
+
+		key->key[key->len++] = *str;
+		key->hash = (key->hash ^ (unsigned char) *str) * 16777619u;
+	} while (*str++);
+
+	return true;
+}
+
+/* Returns false if the names are too long to make a key */
+static bool tinyiiod_attr_key(struct tinyiiod_attr_key *key,
+			      const char *device, const char *channel,
+			      bool ch_out, const char *attr,
+			      enum iio_attr_type type)
+{
+	char prefix[2];
+
+	prefix[0] = channel ? (ch_out ? 'o' : 'i') : '0' + (char) type;
+	prefix[1] = '\0';
+
+	key->hash = 2166136261u;
+	key->len = 0;
+
+	return key_append(key, prefix) && key_append(key, device) &&
+	       key_append(key, channel ? channel : "") &&
+	       key_append(key, attr);
+}
+
+static bool key_equal(const struct tinyiiod_attr_key *a,
+		      const struct tinyiiod_attr_key *b)
+{
+	return a->len == b->len && a->hash == b->hash &&
+	       !memcmp(a->key, b->key, a->len);
+}
+
+/* Returns the handle of the attribute, resolving it on a cache miss */
+static int32_t tinyiiod_lookup_attr(struct tinyiiod *iiod, const char *device,
+				    const char *channel, bool ch_out,
+				    const char *attr, enum iio_attr_type type,
+				    uint32_t *handle)
+{
+	struct tinyiiod_attr_handle *entry, *victim;
+	struct tinyiiod_attr_key key;
+	size_t i;
+	int32_t ret;
+
+	if (!iiod->handles)
+		return -ENOSYS;
+
+	if (!tinyiiod_attr_key(&key, device, channel, ch_out, attr, type))
+		return -ENOSYS;
+
+	victim = iiod->handles;
+	for (i = 0; i < iiod->nb_handles; i++) {
+		entry = &iiod->handles[i];
+
+		if (key_equal(&entry->key, &key)) {
+			entry->last_used = ++iiod->handles_clock;
+			*handle = entry->handle;
+			return 0;
+		}
+
+		if (entry->last_used < victim->last_used)
+			victim = entry;
+	}
+
+	ret = iiod->ops->resolve_attr(iiod->priv, device, channel, ch_out,
+				      attr, type, handle);
+	if (ret < 0)
+		return ret;
+
+	/* Evict the least recently used (or a never used) entry */
+	victim->key = key;
+	victim->handle = *handle;
+	victim->last_used = ++iiod->handles_clock;
+
+	return 0;
+}
+
+/* The debug attribute of the statistics is handled by the library */
+static bool tinyiiod_is_stats_attr(const char *channel, const char *attr,
+				   enum iio_attr_type type)
+{
+#ifdef TINYIIOD_STATS
+	return type == IIO_ATTR_TYPE_DEBUG && !channel &&
+	       !strcmp(attr, TINYIIOD_STATS_ATTR);
+#else
+	return false;
+#endif
+}
+
+/* Cache entry of an attribute, or the one to evict to make room for it */
+static struct tinyiiod_cached_value *
+tinyiiod_cache_find(struct tinyiiod *iiod, const struct tinyiiod_attr_key *key,
+		    struct tinyiiod_cached_value **victim)
+{
+	struct tinyiiod_cached_value *entry;
+	size_t i;
+
+	*victim = iiod->values;
+	for (i = 0; i < iiod->nb_values; i++) {
+		entry = &iiod->values[i];
+
+		if (key_equal(&entry->key, key))
+			return entry;
+
+		if (entry->last_used < (*victim)->last_used)
+			*victim = entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Serve a read from the cache of values. Otherwise returns -ENOENT, and
+ * sets *entry to where the value read from the backend is to be kept.
+ * Entries remember the policy of their attribute, so that the backend is
+ * asked for it only once, even for attributes that are never cached.
+ */
+static ssize_t tinyiiod_cache_read(struct tinyiiod *iiod, const char *device,
+				   const char *channel, bool ch_out,
+				   const char *attr, enum iio_attr_type type,
+				   char *buf, size_t len,
+				   struct tinyiiod_cached_value **entry)
+{
+	struct tinyiiod_cached_value *value, *victim;
+	struct tinyiiod_attr_key key;
+
+	*entry = NULL;
+
+	if (!iiod->values || tinyiiod_is_stats_attr(channel, attr, type) ||
+	    !tinyiiod_attr_key(&key, device, channel, ch_out, attr, type))
+		return -ENOENT;
+
+	value = tinyiiod_cache_find(iiod, &key, &victim);
+	if (!value) {
+		value = victim;
+		value->key = key;
+		value->valid = false;
+		value->ttl = 0;
+		value->policy = iiod->ops->get_cache_policy(iiod->priv, device,
+							    channel, ch_out,
+							    attr, type,
+							    &value->ttl);
+
+		/* Without a clock, values can't expire */
+		if (value->policy == TINYIIOD_CACHE_TTL &&
+		    !iiod->ops->get_time_us)
+			value->policy = TINYIIOD_CACHE_NEVER;
+	}
+
+	value->last_used = ++iiod->values_clock;
+	if (value->policy == TINYIIOD_CACHE_NEVER)
+		return -ENOENT;
+
+	if (value->valid && value->policy == TINYIIOD_CACHE_TTL &&
+	    iiod->ops->get_time_us(iiod->priv) - value->stamp >= value->ttl)
+		value->valid = false;
+
+	if (!value->valid || value->len > len) {
+		iiod->cache_stats.misses++;
+		*entry = value;
+		return -ENOENT;
+	}
+
+	iiod->cache_stats.hits++;
+	memcpy(buf, value->value, value->len);
+
+	return (ssize_t) value->len;
+}
+
+static void tinyiiod_cache_store(struct tinyiiod *iiod,
+				 struct tinyiiod_cached_value *entry,
+				 const char *buf, ssize_t len)
+{
+	/* Errors and big values are read again every time */
+	if (!entry || len < 0 || (size_t) len > sizeof(entry->value))
+		return;
+
+	memcpy(entry->value, buf, (size_t) len);
+	entry->len = (size_t) len;
+	entry->valid = true;
+
+	if (entry->policy == TINYIIOD_CACHE_TTL)
+		entry->stamp = iiod->ops->get_time_us(iiod->priv);
+}
+
+/* Written values are read again from the backend, which may adjust them */
+static void tinyiiod_cache_invalidate(struct tinyiiod *iiod,
+				      const char *device, const char *channel,
+				      bool ch_out, const char *attr,
+				      enum iio_attr_type type)
+{
+	struct tinyiiod_cached_value *entry, *victim;
+	struct tinyiiod_attr_key key;
+
+	if (!iiod->values ||
+	    !tinyiiod_attr_key(&key, device, channel, ch_out, attr, type))
+		return;
+
+	entry = tinyiiod_cache_find(iiod, &key, &victim);
+	if (entry)
+		entry->valid = false;
+}
+
+const struct tinyiiod_cache_stats *
+tinyiiod_get_cache_stats(struct tinyiiod *iiod)
+{
+	return &iiod->cache_stats;
+}
+
+void tinyiiod_invalidate_values(struct tinyiiod *iiod)
+{
+	size_t i;
+
+	for (i = 0; i < iiod->nb_values; i++)
+		iiod->values[i].valid = false;
+}
+
+static ssize_t tinyiiod_read_one_attr(struct tinyiiod *iiod,
+				     const char *device, const char *channel,
+				     bool ch_out, const char *attr,
+				     enum iio_attr_type type,
+				     char *buf, size_t len)
+{
+	const struct tinyiiod_attr_desc *desc;
+	uint32_t handle;
+	ssize_t ret;
+
+#ifdef TINYIIOD_STATS
+	if (tinyiiod_is_stats_attr(channel, attr, type))
+		ret = tinyiiod_stats_print(iiod, buf, len);
+	else
+#endif
+	if (iiod->ctx) {
+		desc = tinyiiod_context_attr(iiod->ctx, device, channel, ch_out,
+					     attr, type);
+		if (!desc)
+			ret = -ENOENT;
+		else if (!desc->read)
+			ret = -ENOSYS;
+		else
+			ret = desc->read(iiod->priv, desc, buf, len);
+	} else if (iiod->ops->read_attr_h &&
+	    !tinyiiod_lookup_attr(iiod, device, channel, ch_out,
+				  attr, type, &handle))
+		ret = iiod->ops->read_attr_h(iiod->priv, handle, buf, len);
+	else if (channel)
+		ret = iiod->ops->ch_read_attr(iiod->priv, device, channel, ch_out,
+					      attr, buf, len);
+	else
+		ret = iiod->ops->read_attr(iiod->priv, device, attr,
+					   buf, len, type);
+
+	/* snprintf() style: the value may not have fit */
+	if (ret > 0 && (size_t) ret > len)
+		ret = (ssize_t) len;
+
+	return ret;
+}
+
+/*
+ * Empty attribute name: all the attributes of the device or channel, in
+ * the order of the context XML, as upstream iiod sends them. Each value is
+ * preceded by its length (or error code) as a big-endian 32-bit word, and
+ * padded to a multiple of 4 bytes.
+ */
+static ssize_t tinyiiod_read_all_attrs(struct tinyiiod *iiod,
+				       const char *device, const char *channel,
+				       bool ch_out, enum iio_attr_type type)
+{
+	struct tinyiiod_cached_value *entry;
+	struct tinyiiod_xml_attrs it;
+	char name[IIOD_ATTR_KEY_SIZE], *value;
+	/* Whole words, so that the padding of the last value fits too */
+	size_t size = iiod->buf_size & ~(size_t) 3, offset = 0, len;
+	ssize_t ret;
+
+	ret = tinyiiod_get_xml(iiod);
+	if (ret < 0)
+		return ret;
+
+	ret = tinyiiod_xml_attrs_init(&it, iiod->xml, device, channel,
+				      ch_out, type);
+	if (ret < 0)
+		return ret;
+
+	while ((ret = tinyiiod_xml_next_attr(&it, name, sizeof(name))) > 0) {
+		if (offset + 4 > size)
+			return -ENOSPC;
+
+		value = iiod->buf + offset + 4;
+		len = size - offset - 4;
+
+		ret = tinyiiod_cache_read(iiod, device, channel, ch_out, name,
+					  type, value, len, &entry);
+		if (ret < 0) {
+			ret = tinyiiod_read_one_attr(iiod, device, channel,
+						     ch_out, name, type,
+						     value, len);
+			tinyiiod_cache_store(iiod, entry, value, ret);
+		}
+
+		tinyiiod_put_be32(iiod->buf + offset, (uint32_t) ret);
+		offset += 4;
+
+		if (ret > 0) {
+			offset += (size_t) ret;
+			for (; offset % 4; offset++)
+				iiod->buf[offset] = '\0';
+		}
+	}
+
+	return ret < 0 ? ret : (ssize_t) offset;
+}
+
+/*
+ * Stream a value bigger than the buffer through it, chunk by chunk. The
+ * length is sent first, so a chunk failing after that is replaced with
+ * zeroes to keep the client in sync.
+ */
+static ssize_t tinyiiod_read_attr_chunks(struct tinyiiod *iiod,
+					 const char *device,
+					 const char *channel, bool ch_out,
+					 const char *attr,
+					 enum iio_attr_type type)
+{
+	size_t size = 0, offset = 0, len, unused;
+	ssize_t ret;
+
+	ret = iiod->ops->read_attr_chunk(iiod->priv, device, channel, ch_out,
+					 attr, type, iiod->buf, 0,
+					 iiod->buf_size, &size);
+	if (ret < 0)
+		return ret;
+
+	if ((size_t) ret > size)
+		ret = (ssize_t) size;
+	if ((size_t) ret > iiod->buf_size)
+		ret = (ssize_t) iiod->buf_size;
+
+	tinyiiod_write_reply(iiod, (int32_t) size, size);
+	if (!size)
+		return 0;
+
+	for (len = (size_t) ret; ; ) {
+		tinyiiod_write(iiod, iiod->buf, len);
+		offset += len;
+		if (offset >= size)
+			break;
+
+		len = size - offset;
+		if (len > iiod->buf_size)
+			len = iiod->buf_size;
+
+		ret = iiod->ops->read_attr_chunk(iiod->priv, device, channel,
+						 ch_out, attr, type, iiod->buf,
+						 offset, len, &unused);
+		if (ret <= 0)
+			memset(iiod->buf, 0, len);
+		else if ((size_t) ret < len)
+			len = (size_t) ret;
+	}
+
+	tinyiiod_write_eol(iiod);
+
+	return (ssize_t) size;
+}
+
+void tinyiiod_do_read_attr(struct tinyiiod *iiod, const char *device,
+			   const char *channel, bool ch_out, const char *attr, enum iio_attr_type type)
+{
+	struct tinyiiod_cached_value *entry;
+	ssize_t ret;
+
+	if (!*attr) {
+		ret = tinyiiod_read_all_attrs(iiod, device, channel, ch_out,
+					      type);
+		goto reply;
+	}
+
+	ret = tinyiiod_cache_read(iiod, device, channel, ch_out, attr, type,
+				  iiod->buf, iiod->buf_size, &entry);
+	if (ret >= 0)
+		goto reply;
+
+	if (iiod->ops->read_attr_chunk &&
+	    !tinyiiod_is_stats_attr(channel, attr, type)) {
+		ret = tinyiiod_read_attr_chunks(iiod, device, channel, ch_out,
+						attr, type);
+		if (ret >= 0)
+			return;
+		if (ret != -ENOSYS) {
+			tinyiiod_write_value(iiod, (int32_t) ret);
+			return;
+		}
+	}
+
+	ret = tinyiiod_read_one_attr(iiod, device, channel, ch_out,
+				     attr, type, iiod->buf, iiod->buf_size);
+	tinyiiod_cache_store(iiod, entry, iiod->buf, ret);
+
+reply:
+	tinyiiod_write_reply(iiod, (int32_t) ret, ret > 0 ? (size_t) ret : 0);
+	if (ret > 0) {
+		tinyiiod_write(iiod, iiod->buf, (size_t) ret);
+		tinyiiod_write_eol(iiod);
+	}
+}
+
+static ssize_t tinyiiod_write_one_attr(struct tinyiiod *iiod,
+				      const char *device, const char *channel,
+				      bool ch_out, const char *attr,
+				      enum iio_attr_type type,
+				      const char *buf, size_t len)
+{
+	const struct tinyiiod_attr_desc *desc;
+	uint32_t handle;
+
+#ifdef TINYIIOD_STATS
+	if (tinyiiod_is_stats_attr(channel, attr, type)) {
+		tinyiiod_reset_stats(iiod);
+		return (ssize_t) len;
+	}
+#endif
+
+	tinyiiod_cache_invalidate(iiod, device, channel, ch_out, attr, type);
+
+	if (iiod->ctx) {
+		desc = tinyiiod_context_attr(iiod->ctx, device, channel, ch_out,
+					     attr, type);
+		if (!desc)
+			return -ENOENT;
+		if (!desc->write)
+			return -ENOSYS;
+
+		return desc->write(iiod->priv, desc, buf, len);
+	}
+
+	if (iiod->ops->write_attr_h &&
+	    !tinyiiod_lookup_attr(iiod, device, channel, ch_out,
+				  attr, type, &handle))
+		return iiod->ops->write_attr_h(iiod->priv, handle, buf, len);
+
+	if (channel)
+		return iiod->ops->ch_write_attr(iiod->priv, device, channel,
+						ch_out, attr, buf, len);
+
+	return iiod->ops->write_attr(iiod->priv, device, attr,
+				     buf, len, type);
+}
+
+/* Empty attribute name: the values of all the attributes, in the format
+ * of tinyiiod_read_all_attrs(). A negative length skips an attribute. */
+static ssize_t tinyiiod_write_all_attrs(struct tinyiiod *iiod,
+					const char *device, const char *channel,
+					bool ch_out, enum iio_attr_type type,
+					size_t bytes)
+{
+	struct tinyiiod_xml_attrs it;
+	char name[IIOD_ATTR_KEY_SIZE], *value, saved;
+	size_t offset = 0;
+	int32_t len;
+	ssize_t ret;
+
+	ret = tinyiiod_get_xml(iiod);
+	if (ret < 0)
+		return ret;
+
+	ret = tinyiiod_xml_attrs_init(&it, iiod->xml, device, channel,
+				      ch_out, type);
+	if (ret < 0)
+		return ret;
+
+	while (offset < bytes &&
+	       (ret = tinyiiod_xml_next_attr(&it, name, sizeof(name))) > 0) {
+		if (bytes - offset < 4)
+			return -EINVAL;
+
+		len = (int32_t) tinyiiod_get_be32(iiod->buf + offset);
+		offset += 4;
+		if (len <= 0)
+			continue;
+		if ((size_t) len > bytes - offset)
+			return -EINVAL;
+
+		/* Values are NUL-terminated for the backend, like single
+		 * writes; the byte after one is padding or the next length */
+		value = iiod->buf + offset;
+		saved = value[len];
+		value[len] = '\0';
+
+		ret = tinyiiod_write_one_attr(iiod, device, channel, ch_out,
+					      name, type, value, (size_t) len);
+		value[len] = saved;
+		if (ret < 0)
+			return ret;
+
+		offset += ((size_t) len + 3) & ~(size_t) 3;
+	}
+
+	return ret < 0 ? ret : (ssize_t) bytes;
+}
+
+/* Hand the value received in iiod->buf to the backend */
+static void tinyiiod_write_attr_done(struct tinyiiod *iiod,
+				     const char *device, const char *channel,
+				     bool ch_out, const char *attr,
+				     size_t bytes, enum iio_attr_type type)
+{
+	ssize_t ret;
+
+	iiod->buf[bytes] = '\0';
+
+	if (!*attr)
+		ret = tinyiiod_write_all_attrs(iiod, device, channel, ch_out,
+					       type, bytes);
+	else
+		ret = tinyiiod_write_one_attr(iiod, device, channel, ch_out,
+					      attr, type, iiod->buf, bytes);
+
+	tinyiiod_write_value(iiod, (int32_t) ret);
+}
+
+/* Size of the next chunk of the value of the pending WRITE */
+size_t tinyiiod_attr_chunk_len(struct tinyiiod *iiod)
+{
+	struct tinyiiod_pending *p = &iiod->pending;
+	size_t len = p->bytes - p->offset;
+
+	return len > iiod->buf_size ? iiod->buf_size : len;
+}
+
+/* Hand the chunk of the pending WRITE received in iiod->buf to the backend,
+ * and answer once the value is complete */
+void tinyiiod_write_attr_chunk(struct tinyiiod *iiod, size_t len)
+{
+	struct tinyiiod_pending *p = &iiod->pending;
+	bool whole = len == p->bytes && len < iiod->buf_size;
+	int32_t ret = -ENOSYS;
+
+	if (p->ret >= 0) {
+		if (*p->attr && iiod->ops->write_attr_chunk &&
+		    !tinyiiod_is_stats_attr(p->channel, p->attr, p->type)) {
+			if (!p->offset)
+				tinyiiod_cache_invalidate(iiod, p->device,
+							  p->channel, p->ch_out,
+							  p->attr, p->type);
+
+			ret = iiod->ops->write_attr_chunk(iiod->priv,
+					p->device, p->channel, p->ch_out,
+					p->attr, p->type, iiod->buf,
+					p->offset, len, p->bytes);
+		}
+
+		if (ret == -ENOSYS && whole) {
+			p->state = TINYIIOD_STATE_IDLE;
+			tinyiiod_write_attr_done(iiod, p->device, p->channel,
+						 p->ch_out, p->attr, len,
+						 p->type);
+			return;
+		}
+
+		/* Too big for the buffer, and no other way to write it */
+		if (ret == -ENOSYS)
+			ret = -ENOSPC;
+		if (ret < 0)
+			p->ret = ret;
+	}
+
+	/* After an error, the rest of the value is only drained */
+	p->offset += len;
+
+	if (p->offset == p->bytes) {
+		p->state = TINYIIOD_STATE_IDLE;
+		tinyiiod_write_value(iiod, p->ret < 0 ?
+				     p->ret : (int32_t) p->bytes);
+	}
+}
+
+void tinyiiod_do_write_attr(struct tinyiiod *iiod, const char *device,
+			    const char *channel, bool ch_out, const char *attr,
+			    size_t bytes, enum iio_attr_type type)
+{
+	struct tinyiiod_pending *p = &iiod->pending;
+	size_t len;
+
+	p->state = TINYIIOD_STATE_WRITE_ATTR;
+	p->device = device;
+	p->channel = channel;
+	p->ch_out = ch_out;
+	p->attr = attr;
+	p->type = type;
+	p->bytes = bytes;
+	p->offset = 0;
+	p->fill = 0;
+	p->ret = 0;
+
+	/* The value will come with the next tinyiiod_feed() calls */
+	if (iiod->feeding && bytes)
+		return;
+
+	do {
+		len = tinyiiod_attr_chunk_len(iiod);
+		if (tinyiiod_read_exact(iiod, iiod->buf, len) < 0) {
+			p->state = TINYIIOD_STATE_IDLE;
+			return;
+		}
+
+		tinyiiod_write_attr_chunk(iiod, len);
+	} while (p->state == TINYIIOD_STATE_WRITE_ATTR);
+}
+
+void tinyiiod_do_open(struct tinyiiod *iiod, const char *device,
+		      size_t sample_size, const struct tinyiiod_mask *mask,
+		      bool cyclic)
+{
+	int32_t ret = 0;
+	size_t i;
+
+	if (iiod->ops->open_mask) {
+		ret = iiod->ops->open_mask(iiod->priv, device, sample_size,
+					   mask->words, mask->nb_words, cyclic);
+	} else {
+		for (i = 1; i < mask->nb_words; i++)
+			if (mask->words[i])
+				ret = -EINVAL;
+		if (!ret)
+			ret = iiod->ops->open(iiod->priv, device, sample_size,
+					      mask->words[0], cyclic);
+	}
+
+	iiod->pipe.queued = 0;
+	tinyiiod_write_value(iiod, ret);
+}
+
+void tinyiiod_do_close(struct tinyiiod *iiod, const char *device)
+{
+	int32_t ret = iiod->ops->close(iiod->priv, device);
+
+	iiod->pipe.queued = 0;
+	iiod->stream.active = false;
+	tinyiiod_write_value(iiod, ret);
+}
+
+int32_t tinyiiod_do_open_instance(struct tinyiiod *iiod)
 {
-	struct tinyiiod *iiod = malloc(sizeof(*iiod));
+	if (iiod->ops->open_instance)
+		return iiod->ops->open_instance(iiod->priv);
 
-	if (!iiod)
-		return NULL;
+	return 0;
+}
 
-	iiod->buf = malloc(IIOD_BUFFER_SIZE);
-	if (!iiod->buf) {
-		free(iiod);
-		return NULL;
-	}
-	iiod->ops = ops;
+int32_t tinyiiod_do_close_instance(struct tinyiiod *iiod)
+{
+	if (iiod->ops->close_instance)
+		return iiod->ops->close_instance(iiod->priv);
 
-	return iiod;
+	return 0;
 }
 
-void tinyiiod_destroy(struct tinyiiod *iiod)
+/* Wait for tinyiiod_transfer_done() before answering the command */
+static void tinyiiod_park_transfer(struct tinyiiod *iiod, const char *device,
+				   size_t bytes_count,
+				   const struct tinyiiod_mask *mask)
 {
-	free(iiod->buf);
-	free(iiod);
+	struct tinyiiod_pending *p = &iiod->pending;
+
+	p->state = TINYIIOD_STATE_TRANSFER;
+	p->device = device;
+	p->bytes = bytes_count;
+	p->to_dev = !mask;
+	if (mask)
+		p->mask = *mask;
 }
 
-int32_t tinyiiod_read_command(struct tinyiiod *iiod)
+static int32_t tinyiiod_writebuf_reply(struct tinyiiod *iiod,
+				       size_t bytes_count, int32_t ret)
 {
-	char buf[128];
-	int32_t ret;
+	if (ret >= 0) {
+		ret = (int32_t) bytes_count;
+		tinyiiod_stats_bytes(iiod, TINYIIOD_OP_WRITEBUF, bytes_count);
+	}
+	tinyiiod_write_value(iiod, ret);
+
+	return ret;
+}
 
-	ret = tinyiiod_read_line(iiod, buf, sizeof(buf));
+int32_t tinyiiod_writebuf_done(struct tinyiiod *iiod, const char *device,
+			       size_t bytes_count, int32_t ret)
+{
 	if (ret < 0)
-		return ret;
+		return tinyiiod_writebuf_reply(iiod, bytes_count, ret);
 
-	return tinyiiod_parse_string(iiod, buf);
+	if (iiod->feeding && iiod->ops->start_mem_to_dev) {
+		ret = (int32_t) iiod->ops->start_mem_to_dev(iiod->priv, device,
+							    bytes_count);
+		if (ret == -EINPROGRESS) {
+			tinyiiod_park_transfer(iiod, device, bytes_count,
+					       NULL);
+			return 0;
+		}
+	} else if (iiod->ops->transfer_mem_to_dev) {
+		ret = (int32_t) iiod->ops->transfer_mem_to_dev(iiod->priv,
+							       device,
+							       bytes_count);
+	}
+
+	return tinyiiod_writebuf_reply(iiod, bytes_count, ret);
 }
 
-ssize_t tinyiiod_read(struct tinyiiod *iiod, char *buf, size_t len)
+/* Where the next bytes of a WRITEBUF payload go: straight into the output
+ * buffer when the backend exposes it, into iiod->buf otherwise */
+static ssize_t tinyiiod_get_write_buf(struct tinyiiod *iiod,
+				      const char *device, char **buf,
+				      size_t offset, size_t bytes_count)
 {
-	return iiod->ops->read(buf, len);
+	if (iiod->ops->get_write_ptr)
+		return iiod->ops->get_write_ptr(iiod->priv, device, buf,
+						offset, bytes_count);
+
+	if (bytes_count > iiod->buf_size)
+		bytes_count = iiod->buf_size;
+
+	*buf = iiod->buf;
+
+	return (ssize_t) bytes_count;
 }
 
-ssize_t tinyiiod_read_line(struct tinyiiod *iiod, char *buf, size_t len)
+int32_t tinyiiod_do_writebuf(struct tinyiiod *iiod,
+			     const char *device, size_t bytes_count)
 {
-	char ch;
-	uint32_t i;
-	bool found = false;
-	int32_t ret;
+	size_t offset = 0, total_bytes = bytes_count;
+	struct tinyiiod_pending *p = &iiod->pending;
+	int32_t err = 0;
+	ssize_t ret;
+	char *buf;
 
-	if (iiod->ops->read_line)
-		return iiod->ops->read_line(buf, len);
+	tinyiiod_write_value(iiod, bytes_count);
 
-	for (i = 0; i < len - 1; i++) {
-		ret = iiod->ops->read(&ch, 1);
-		if (ret <= 0)
-			return -EIO;
-		buf[i] = ch;
-		if (buf[i] != '\n')
-			found = true;
-		else if (found)
-			break;
+	if (iiod->feeding && bytes_count) {
+		/* The data will come with the next tinyiiod_feed() calls */
+		p->state = TINYIIOD_STATE_WRITEBUF;
+		p->device = device;
+		p->bytes = bytes_count;
+		p->offset = 0;
+		p->ret = 0;
+		return 0;
 	}
 
-	if (!found || i == len - 1) {
-		/* No \n found -> garbage data */
-		return -EIO;
+	while (bytes_count) {
+		/* After an error, the rest of the payload is only drained */
+		if (err < 0) {
+			ret = tinyiiod_read(iiod, iiod->buf,
+					    bytes_count < iiod->buf_size ?
+					    bytes_count : iiod->buf_size);
+			if (ret <= 0)
+				return ret < 0 ? (int32_t) ret : -EIO;
+
+			bytes_count -= (size_t) ret;
+			continue;
+		}
+
+		ret = tinyiiod_get_write_buf(iiod, device, &buf, offset,
+					     bytes_count);
+		if (ret <= 0) {
+			err = ret < 0 ? (int32_t) ret : -EIO;
+			continue;
+		}
+
+		ret = tinyiiod_read(iiod, buf, (size_t) ret);
+		if (ret <= 0)
+			return ret < 0 ? (int32_t) ret : -EIO;
+
+		if (!iiod->ops->get_write_ptr) {
+			ssize_t wr = iiod->ops->write_data(iiod->priv, device,
+							   buf, offset,
+							   (size_t) ret);
+
+			if (wr < 0)
+				err = (int32_t) wr;
+		}
+
+		offset += (size_t) ret;
+		bytes_count -= (size_t) ret;
 	}
 
-	buf[i - 1] = '\0';
+	return tinyiiod_writebuf_done(iiod, device, total_bytes, err);
+}
 
-	return i;
+int32_t tinyiiod_do_rearm(struct tinyiiod *iiod, const char *device)
+{
+	ssize_t ret = -ENOSYS;
+
+	if (iiod->ops->rearm)
+		ret = iiod->ops->rearm(iiod->priv, device);
+
+	tinyiiod_write_value(iiod, (int32_t) ret);
+
+	return (int32_t) ret;
 }
 
-ssize_t tinyiiod_write_char(struct tinyiiod *iiod, char c)
+static bool tinyiiod_pipelined(struct tinyiiod *iiod)
 {
-	return iiod->ops->write(&c, 1);
+	return iiod->ops->submit_block && iiod->ops->dequeue_block &&
+	       iiod->pipe.count > 1;
 }
 
-ssize_t tinyiiod_write(struct tinyiiod *iiod, const char *data, size_t len)
+/* Wait for the blocks still in flight, and forget about them */
+static void tinyiiod_drain_blocks(struct tinyiiod *iiod)
 {
-	return iiod->ops->write(data, len);
+	struct tinyiiod_pipeline *p = &iiod->pipe;
+	bool overrun;
+	char *data;
+
+	for (; p->queued; p->queued--)
+		if (iiod->ops->dequeue_block(iiod->priv, p->device,
+					     &data, &overrun) < 0)
+			break;
+
+	p->queued = 0;
 }
 
-ssize_t tinyiiod_write_string(struct tinyiiod *iiod, const char *str)
+static int32_t tinyiiod_submit_blocks(struct tinyiiod *iiod)
 {
-	return tinyiiod_write(iiod, str, strlen(str));
+	struct tinyiiod_pipeline *p = &iiod->pipe;
+	int32_t ret;
+
+	for (; p->queued < p->count; p->queued++) {
+		ret = iiod->ops->submit_block(iiod->priv, p->device, p->bytes);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
 }
 
-ssize_t tinyiiod_write_value(struct tinyiiod *iiod, int32_t value)
+/* Bytes to capture for bytes_count bytes of the enabled channels */
+static size_t tinyiiod_capture_size(struct tinyiiod *iiod, size_t bytes_count)
 {
-	char buf[16];
+	struct tinyiiod_scan_layout *layout = iiod->layout;
 
-	snprintf(buf, sizeof(buf), "%"PRIi32"\n", value);
-	return tinyiiod_write_string(iiod, buf);
+	if (!layout)
+		return bytes_count;
+
+	return bytes_count / layout->packed_size * layout->scan_size;
 }
 
-void tinyiiod_write_xml(struct tinyiiod *iiod)
+/* Send a captured block, keeping only the enabled channels of its scans */
+static void tinyiiod_write_scans(struct tinyiiod *iiod, const char *data,
+				 size_t bytes_count)
 {
-	char *xml;
-	iiod->ops->get_xml(&xml);
-	size_t len = strlen(xml);
+	struct tinyiiod_scan_layout *layout = iiod->layout;
+	size_t nb_scans, max_scans, n;
+
+	if (!layout || layout->packed_size == layout->scan_size) {
+		tinyiiod_write(iiod, data, bytes_count);
+		return;
+	}
 
-	tinyiiod_write_value(iiod, len);
-	tinyiiod_write(iiod, xml, len);
-	tinyiiod_write_char(iiod, '\n');
+	nb_scans = bytes_count / layout->packed_size;
+	max_scans = (iiod->buf_size - TINYIIOD_PACK_SLACK) /
+		    layout->packed_size;
+
+	for (; nb_scans; nb_scans -= n) {
+		n = nb_scans < max_scans ? nb_scans : max_scans;
+
+		tinyiiod_pack_scans(layout, iiod->buf, data, n);
+		tinyiiod_write(iiod, iiod->buf, n * layout->packed_size);
+		data += n * layout->scan_size;
+	}
 }
 
-void tinyiiod_do_read_attr(struct tinyiiod *iiod, const char *device,
-			   const char *channel, bool ch_out, const char *attr, enum iio_attr_type type)
+/* Send the oldest captured block while the next ones are being filled */
+static int32_t tinyiiod_readbuf_pipelined(struct tinyiiod *iiod,
+					  const char *device,
+					  size_t bytes_count,
+					  const struct tinyiiod_mask *mask)
 {
+	struct tinyiiod_pipeline *p = &iiod->pipe;
+	size_t capture = tinyiiod_capture_size(iiod, bytes_count);
+	bool overrun = false;
+	char *data;
 	ssize_t ret;
 
-	if (channel)
-		ret = iiod->ops->ch_read_attr(device, channel,
-					      ch_out, attr, iiod->buf, IIOD_BUFFER_SIZE);
-	else
-		ret = iiod->ops->read_attr(device, attr,
-					   iiod->buf, IIOD_BUFFER_SIZE, type);
+	if (iiod->layout && bytes_count % iiod->layout->packed_size) {
+		tinyiiod_write_value(iiod, -EINVAL);
+		return -EINVAL;
+	}
 
-	tinyiiod_write_value(iiod, (int32_t) ret);
-	if (ret > 0) {
-		iiod->buf[ret] = '\n';
-		tinyiiod_write(iiod, iiod->buf, (size_t) ret + 1);
+	if (p->queued &&
+	    (p->bytes != capture || strcmp(p->device, device)))
+		tinyiiod_drain_blocks(iiod);
+
+	if (!p->queued) {
+		snprintf(p->device, sizeof(p->device), "%s", device);
+		p->bytes = capture;
+	}
+
+	ret = tinyiiod_submit_blocks(iiod);
+	if (ret >= 0 && !p->queued)
+		ret = -EIO;
+	if (ret >= 0)
+		ret = iiod->ops->dequeue_block(iiod->priv, device,
+					       &data, &overrun);
+	if (ret >= 0) {
+		p->queued--;
+		if (overrun)
+			p->overruns++;
+		if ((size_t) ret != p->bytes)
+			ret = -EIO;
+	}
+	if (ret < 0) {
+		tinyiiod_write_value(iiod, (int32_t) ret);
+		return (int32_t) ret;
 	}
+
+	tinyiiod_write_reply(iiod, (int32_t) bytes_count,
+			     bytes_count + tinyiiod_mask_size(iiod, mask));
+	tinyiiod_write_mask(iiod, mask);
+	tinyiiod_write_scans(iiod, data, bytes_count);
+	tinyiiod_stats_bytes(iiod, TINYIIOD_OP_READBUF, bytes_count);
+
+	/* The block went out: put it back in the ring right away */
+	tinyiiod_submit_blocks(iiod);
+
+	return (int32_t) ret;
 }
 
-void tinyiiod_do_write_attr(struct tinyiiod *iiod, const char *device,
-			    const char *channel, bool ch_out, const char *attr,
-			    size_t bytes, enum iio_attr_type type)
+static bool tinyiiod_same_mask(const struct tinyiiod_mask *a,
+			       const struct tinyiiod_mask *b)
+{
+	return a->nb_words == b->nb_words &&
+	       !memcmp(a->words, b->words, a->nb_words * sizeof(*a->words));
+}
+
+/* Find out where the enabled channels sit, if the backend gives full scans */
+static int32_t tinyiiod_update_layout(struct tinyiiod *iiod,
+				      const char *device,
+				      const struct tinyiiod_mask *mask)
 {
+	struct tinyiiod_scan_layout *layout = iiod->layout;
 	ssize_t ret;
 
-	if (bytes > IIOD_BUFFER_SIZE - 1)
-		bytes = IIOD_BUFFER_SIZE - 1;
+	if (!layout || (layout->valid && !strcmp(layout->device, device) &&
+			tinyiiod_same_mask(&layout->mask, mask)))
+		return 0;
 
-	tinyiiod_read(iiod, iiod->buf, bytes);
-	iiod->buf[bytes] = '\0';
+	ret = tinyiiod_get_xml(iiod);
+	if (ret < 0)
+		return (int32_t) ret;
 
-	if (channel)
-		ret = iiod->ops->ch_write_attr(device, channel, ch_out,
-					       attr, iiod->buf, bytes);
-	else
-		ret = iiod->ops->write_attr(device, attr, iiod->buf, bytes, type);
+	return tinyiiod_scan_layout_init(layout, iiod->xml, device, mask,
+					 iiod->buf_size);
+}
 
-	tinyiiod_write_value(iiod, (int32_t) ret);
+static ssize_t tinyiiod_transfer(struct tinyiiod *iiod, const char *device,
+				 size_t bytes_count, bool async)
+{
+	struct tinyiiod_scan_layout *layout = iiod->layout;
+
+	if (layout && bytes_count % layout->packed_size)
+		return -EINVAL;
+
+	bytes_count = tinyiiod_capture_size(iiod, bytes_count);
+
+	if (async && iiod->ops->start_dev_to_mem)
+		return iiod->ops->start_dev_to_mem(iiod->priv, device,
+						   bytes_count);
+
+	if (!iiod->ops->transfer_dev_to_mem)
+		return 0;
+
+	return iiod->ops->transfer_dev_to_mem(iiod->priv, device, bytes_count);
 }
 
-void tinyiiod_do_open(struct tinyiiod *iiod, const char *device,
-		      size_t sample_size, uint32_t mask, bool cyclic)
+/* Extract the enabled channels of the next full scans into iiod->buf */
+static ssize_t tinyiiod_get_packed(struct tinyiiod *iiod, const char *device,
+				   char **data, size_t offset,
+				   size_t bytes_count)
 {
-	int32_t ret = iiod->ops->open(device, sample_size, mask, cyclic);
-	tinyiiod_write_value(iiod, ret);
+	struct tinyiiod_scan_layout *layout = iiod->layout;
+	size_t nb_scans = bytes_count / layout->packed_size, max_scans;
+	char *scans;
+	ssize_t ret;
+
+	ret = iiod->ops->get_scans_ptr(iiod->priv, device, &scans,
+				       offset / layout->packed_size *
+				       layout->scan_size,
+				       nb_scans * layout->scan_size);
+	if (ret < 0)
+		return ret;
+
+	nb_scans = (size_t) ret / layout->scan_size;
+
+	/* All the channels are enabled: nothing to extract */
+	if (layout->packed_size == layout->scan_size) {
+		*data = scans;
+		return (ssize_t) (nb_scans * layout->scan_size);
+	}
+
+	max_scans = (iiod->buf_size - TINYIIOD_PACK_SLACK) /
+		    layout->packed_size;
+	if (nb_scans > max_scans)
+		nb_scans = max_scans;
+
+	tinyiiod_pack_scans(layout, iiod->buf, scans, nb_scans);
+	*data = iiod->buf;
+
+	return (ssize_t) (nb_scans * layout->packed_size);
 }
 
-void tinyiiod_do_close(struct tinyiiod *iiod, const char *device)
+/* Point *data to up to bytes_count captured bytes, at the given offset */
+static ssize_t tinyiiod_get_data(struct tinyiiod *iiod, const char *device,
+				 char **data, size_t offset, size_t bytes_count)
 {
-	int32_t ret = iiod->ops->close(device);
-	tinyiiod_write_value(iiod, ret);
+	if (iiod->layout)
+		return tinyiiod_get_packed(iiod, device, data, offset,
+					   bytes_count);
+
+	if (iiod->ops->get_data_ptr)
+		return iiod->ops->get_data_ptr(iiod->priv, device, data,
+					       offset, bytes_count);
+
+	if (bytes_count > iiod->buf_size)
+		bytes_count = iiod->buf_size;
+
+	*data = iiod->buf;
+
+	return iiod->ops->read_data(iiod->priv, device, iiod->buf,
+				    offset, bytes_count);
 }
 
-int32_t tinyiiod_do_open_instance(struct tinyiiod *iiod)
+/* Header of a STREAM block: its size, or an error code that ends the
+ * stream (no data follows then), and its sequence number */
+static size_t tinyiiod_stream_header(struct tinyiiod *iiod, char *header,
+				     size_t len, int32_t size, uint32_t seq)
 {
-	if (iiod->ops->open_instance)
-		return iiod->ops->open_instance();
+	if (!iiod->binary)
+		return (size_t) snprintf(header, len, "%"PRIi32"\n%"PRIu32"\n",
+					 size, seq);
 
-	return 0;
+	header[0] = TINYIIOD_OP_STREAM;
+	header[1] = (char) iiod->client_id;
+	header[2] = 0;
+	header[3] = 0;
+	tinyiiod_put_le32(header + 4, (uint32_t) (size > 0 ? size : 0) + 4);
+	tinyiiod_put_le32(header + 8, (uint32_t) size);
+	tinyiiod_put_le32(header + TINYIIOD_BINARY_HEADER_SIZE, seq);
+
+	return TINYIIOD_BINARY_HEADER_SIZE + 4;
 }
 
-int32_t tinyiiod_do_close_instance(struct tinyiiod *iiod)
+/* Stand-in for data promised by a header that could not be captured */
+static void tinyiiod_write_zeroes(struct tinyiiod *iiod, size_t len)
 {
-	if (iiod->ops->close_instance)
-		return iiod->ops->close_instance();
+	size_t bytes = len < iiod->buf_size ? len : iiod->buf_size;
 
-	return 0;
+	memset(iiod->buf, 0, bytes);
+
+	for (; len; len -= bytes) {
+		bytes = len < iiod->buf_size ? len : iiod->buf_size;
+		tinyiiod_write(iiod, iiod->buf, bytes);
+	}
 }
 
-int32_t tinyiiod_do_writebuf(struct tinyiiod *iiod,
-			     const char *device, size_t bytes_count)
+/* Capture a block without the pipeline, and send it after its header */
+static int32_t tinyiiod_stream_block(struct tinyiiod *iiod, const char *device,
+				     size_t bytes_count, const char *header,
+				     size_t header_len)
 {
-	size_t bytes, offset = 0, total_bytes = bytes_count;
-	char buf[256];
-	int32_t ret = 0;
+	size_t offset = 0;
+	ssize_t ret;
+	char *data;
 
-	tinyiiod_write_value(iiod, bytes_count);
-	while (bytes_count) {
-		bytes = bytes_count > sizeof(buf) ? sizeof(buf) : bytes_count;
-		ret = tinyiiod_read(iiod, buf, bytes);
-		if (ret > 0) {
-			ret = iiod->ops->write_data(device, buf, offset, ret);
-			offset += ret;
-			if (ret < 0)
-				return ret;
-			bytes_count -= ret;
-		} else
-			return ret;
+	ret = tinyiiod_transfer(iiod, device, bytes_count, false);
+	if (ret < 0)
+		return (int32_t) ret;
+
+	tinyiiod_write(iiod, header, header_len);
+
+	while (offset < bytes_count) {
+		ret = tinyiiod_get_data(iiod, device, &data, offset,
+					bytes_count - offset);
+		if (ret <= 0) {
+			/* The header announced the whole block */
+			tinyiiod_write_zeroes(iiod, bytes_count - offset);
+			return ret < 0 ? (int32_t) ret : -EIO;
+		}
+		if ((size_t) ret < bytes_count - offset)
+			tinyiiod_stats_short_read(iiod);
+
+		tinyiiod_write(iiod, data, (size_t) ret);
+		offset += (size_t) ret;
+	}
+
+	return (int32_t) bytes_count;
+}
+
+int32_t tinyiiod_stream_step(struct tinyiiod *iiod)
+{
+	struct tinyiiod_stream *s = &iiod->stream;
+	struct tinyiiod_pipeline *p = &iiod->pipe;
+	/* Room for the text header too: two 32-bit numbers in decimal */
+	char header[TINYIIOD_BINARY_HEADER_SIZE + 16];
+	size_t header_len;
+	bool overrun = false;
+	char *data = NULL;
+	ssize_t ret;
+
+	if (!s->active)
+		return 0;
+
+	/* A READBUF in between may have changed the layout */
+	ret = tinyiiod_update_layout(iiod, s->device, &s->mask);
+	if (ret < 0)
+		goto err_stop;
+
+	if (tinyiiod_pipelined(iiod)) {
+		size_t capture = tinyiiod_capture_size(iiod, s->bytes);
+
+		if (p->queued && (p->bytes != capture ||
+				  strcmp(p->device, s->device)))
+			tinyiiod_drain_blocks(iiod);
+
+		if (!p->queued) {
+			memcpy(p->device, s->device, sizeof(p->device));
+			p->bytes = capture;
+		}
+
+		ret = tinyiiod_submit_blocks(iiod);
+		if (ret >= 0 && !p->queued)
+			ret = -EIO;
+		if (ret >= 0)
+			ret = iiod->ops->dequeue_block(iiod->priv, s->device,
+						       &data, &overrun);
+		if (ret >= 0) {
+			p->queued--;
+			if (overrun)
+				p->overruns++;
+			if ((size_t) ret != p->bytes)
+				ret = -EIO;
+		}
+		if (ret < 0)
+			goto err_stop;
 	}
-	if (iiod->ops->transfer_mem_to_dev) {
-		ret = iiod->ops->transfer_mem_to_dev(device, total_bytes);
+
+	/* Leave a hole in the sequence numbers for lost samples */
+	if (overrun)
+		s->seq++;
+
+	header_len = tinyiiod_stream_header(iiod, header, sizeof(header),
+					    (int32_t) s->bytes, s->seq);
+
+	if (data) {
+		tinyiiod_write(iiod, header, header_len);
+		tinyiiod_write_scans(iiod, data, s->bytes);
+		tinyiiod_submit_blocks(iiod);
+	} else {
+		ret = tinyiiod_stream_block(iiod, s->device, s->bytes,
+					    header, header_len);
 		if (ret < 0)
-			return ret;
+			goto err_stop;
 	}
-	tinyiiod_write_value(iiod, (int) total_bytes);
 
-	return ret;
+	s->seq++;
+	tinyiiod_stats_bytes(iiod, TINYIIOD_OP_STREAM, s->bytes);
+	tinyiiod_flush(iiod);
+
+	return (int32_t) s->bytes;
+
+err_stop:
+	/* Tell the client, which would otherwise wait for the next block */
+	s->active = false;
+	header_len = tinyiiod_stream_header(iiod, header, sizeof(header),
+					    (int32_t) ret, s->seq);
+	tinyiiod_write(iiod, header, header_len);
+	tinyiiod_flush(iiod);
+
+	return (int32_t) ret;
 }
 
-int32_t tinyiiod_do_readbuf(struct tinyiiod *iiod,
-			    const char *device, size_t bytes_count)
+int32_t tinyiiod_do_stream(struct tinyiiod *iiod,
+			   const char *device, size_t bytes_count)
 {
+	struct tinyiiod_stream *s = &iiod->stream;
+	struct tinyiiod_mask mask;
 	int32_t ret;
-	char buf[256];
-	uint32_t mask;
-	bool print_mask = true;
-	size_t offset = 0;
 
-	ret = iiod->ops->get_mask(device, &mask);
+	if (!bytes_count) {
+		s->active = false;
+		tinyiiod_write_value(iiod, 0);
+		return 0;
+	}
+
+	/* Without read_ready(), incoming commands can't be noticed */
+	if (!iiod->feeding && !iiod->ops->read_ready)
+		ret = -ENOSYS;
+	else if (strlen(device) >= sizeof(s->device) ||
+		 bytes_count > INT32_MAX)
+		ret = -EINVAL;
+	else
+		ret = tinyiiod_get_mask(iiod, device, &mask);
+	if (ret >= 0 && iiod->layout) {
+		ret = tinyiiod_update_layout(iiod, device, &mask);
+		if (ret >= 0 && bytes_count % iiod->layout->packed_size)
+			ret = -EINVAL;
+	}
 	if (ret < 0) {
+		tinyiiod_write_value(iiod, ret);
 		return ret;
 	}
-	if (iiod->ops->transfer_dev_to_mem) {
-		ret = iiod->ops->transfer_dev_to_mem(device, bytes_count);
-		if (ret < 0)
-			return ret;
-	}
-	while (bytes_count) {
-		size_t bytes = bytes_count > sizeof(buf) ? sizeof(buf) : bytes_count;
 
-		ret = (int) iiod->ops->read_data(device, buf, offset, bytes);
-		offset += bytes;
-		tinyiiod_write_value(iiod, ret);
-		if (ret < 0)
+	tinyiiod_write_reply(iiod, 0, tinyiiod_mask_size(iiod, &mask));
+	tinyiiod_write_mask(iiod, &mask);
+
+	strcpy(s->device, device);
+	s->mask = mask;
+	s->bytes = bytes_count;
+	s->seq = 0;
+	s->active = true;
+
+	return 0;
+}
+
+int32_t tinyiiod_do_stop(struct tinyiiod *iiod, const char *device)
+{
+	struct tinyiiod_stream *s = &iiod->stream;
+	int32_t ret = 0;
+
+	/* The buffer stays open, for READBUF or another STREAM */
+	if (s->active && !strcmp(s->device, device))
+		s->active = false;
+	else
+		ret = -EBADF;
+
+	tinyiiod_write_value(iiod, ret);
+
+	return ret;
+}
+
+/* Send the captured data, after the reply and the mask */
+static int32_t tinyiiod_send_buffer(struct tinyiiod *iiod, const char *device,
+				    size_t bytes_count,
+				    const struct tinyiiod_mask *mask)
+{
+	int32_t ret = 0;
+	char *data;
+	bool print_mask = true;
+	size_t offset = 0;
+
+	while (bytes_count) {
+		ret = (int32_t) tinyiiod_get_data(iiod, device, &data, offset,
+						  bytes_count);
+		if (ret < 0) {
+			tinyiiod_write_value(iiod, ret);
 			return ret;
+		}
+		offset += (size_t) ret;
 
 		if (print_mask) {
-			char buf_mask[10];
-
-			snprintf(buf_mask, sizeof(buf_mask), "%08"PRIx32"\n", mask);
-			tinyiiod_write_string(iiod, buf_mask);
+			tinyiiod_write_reply(iiod, ret, (size_t) ret +
+					     tinyiiod_mask_size(iiod, mask));
+			tinyiiod_write_mask(iiod, mask);
 			print_mask = false;
+		} else {
+			tinyiiod_write_reply(iiod, ret, (size_t) ret);
 		}
 
-		tinyiiod_write(iiod, buf, (size_t) ret);
+		if (!ret)
+			return -EIO;
+		if ((size_t) ret < bytes_count)
+			tinyiiod_stats_short_read(iiod);
+
+		tinyiiod_write(iiod, data, (size_t) ret);
+		tinyiiod_stats_bytes(iiod, TINYIIOD_OP_READBUF, (size_t) ret);
 		bytes_count -= (size_t) ret;
 	}
 
 	return ret;
 }
 
+int32_t tinyiiod_do_readbuf(struct tinyiiod *iiod,
+			    const char *device, size_t bytes_count)
+{
+	struct tinyiiod_mask mask;
+	int32_t ret;
+
+	ret = tinyiiod_get_mask(iiod, device, &mask);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = tinyiiod_update_layout(iiod, device, &mask);
+	if (ret < 0)
+		return ret;
+
+	if (tinyiiod_pipelined(iiod))
+		return tinyiiod_readbuf_pipelined(iiod, device, bytes_count,
+						  &mask);
+	if (iiod->pipe.queued)
+		tinyiiod_drain_blocks(iiod);
+
+	ret = (int32_t) tinyiiod_transfer(iiod, device, bytes_count,
+					  iiod->feeding);
+	if (ret == -EINPROGRESS) {
+		tinyiiod_park_transfer(iiod, device, bytes_count, &mask);
+		return 0;
+	}
+	if (ret < 0)
+		return ret;
+
+	return tinyiiod_send_buffer(iiod, device, bytes_count, &mask);
+}
+
+int32_t tinyiiod_transfer_done(struct tinyiiod *iiod, ssize_t ret)
+{
+	struct tinyiiod_pending *p = &iiod->pending;
+	size_t len;
+
+	if (p->state != TINYIIOD_STATE_TRANSFER)
+		return -EINVAL;
+
+	p->state = TINYIIOD_STATE_IDLE;
+
+	if (p->to_dev)
+		tinyiiod_writebuf_reply(iiod, p->bytes, (int32_t) ret);
+	else if (ret < 0)
+		tinyiiod_write_value(iiod, (int32_t) ret);
+	else
+		tinyiiod_send_buffer(iiod, p->device, p->bytes, &p->mask);
+	tinyiiod_flush(iiod);
+
+	/* Then the commands that came in the meantime */
+	len = iiod->rx_len;
+	iiod->rx_len = 0;
+
+	return len ? tinyiiod_feed(iiod, iiod->rx_buf, len) : 0;
+}
+
 int32_t tinyiiod_set_timeout(struct tinyiiod *iiod, uint32_t timeout)
 {
 	int32_t ret = 0;
 
 	if (iiod->ops->set_timeout)
-		ret = iiod->ops->set_timeout(timeout);
+		ret = iiod->ops->set_timeout(iiod->priv, timeout);
 	tinyiiod_write_value(iiod, ret);
 
 	return ret;
@@ -287,7 +2253,10 @@ int32_t tinyiiod_set_buffers_count(struct tinyiiod *iiod, const char *device,
 	int32_t ret = 0;
 
 	if (iiod->ops->set_buffers_count)
-		ret = iiod->ops->set_buffers_count(device, buffers_count);
+		ret = iiod->ops->set_buffers_count(iiod->priv, device,
+						   buffers_count);
+	if (ret >= 0)
+		iiod->pipe.count = buffers_count;
 	tinyiiod_write_value(iiod, ret);
 
 	return ret;
@@ -299,13 +2268,13 @@ int32_t tinyiiod_do_gettrig(struct tinyiiod *iiod, const char *device)
 	int32_t ret = -EINVAL;
 
 	if (iiod->ops->get_trigger)
-		ret = iiod->ops->get_trigger(device, iiod->buf,
-					     IIOD_BUFFER_SIZE);
-	tinyiiod_write_value(iiod, ret);
+		ret = iiod->ops->get_trigger(iiod->priv, device, iiod->buf,
+					     iiod->buf_size);
+	tinyiiod_write_reply(iiod, ret, ret > 0 ? (size_t) ret : 0);
 
 	if (ret > 0) {
-		iiod->buf[ret] = '\n';
-		tinyiiod_write(iiod, iiod->buf, (size_t) ret + 1);
+		tinyiiod_write(iiod, iiod->buf, (size_t) ret);
+		tinyiiod_write_eol(iiod);
 	}
 
 	return ret;
@@ -317,7 +2286,8 @@ int32_t tinyiiod_do_settrig(struct tinyiiod *iiod, const char *device,
 	int32_t ret = -EINVAL;
 
 	if (iiod->ops->set_trigger)
-		ret = iiod->ops->set_trigger(device, trigger_name, bytes_count);
+		ret = iiod->ops->set_trigger(iiod->priv, device,
+					     trigger_name, bytes_count);
 	tinyiiod_write_value(iiod, ret);
 
 	return ret;
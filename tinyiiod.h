@@ -38,6 +38,90 @@ enum iio_attr_type {
 	IIO_ATTR_TYPE_BUFFER = 2,
 };
 
+/*
+ * Binary protocol, enabled on a connection with the BINARY text command and
+ * left with TINYIIOD_OP_TEXT. Requests and responses start with a header of
+ * TINYIIOD_BINARY_HEADER_SIZE bytes, multi-byte fields being little-endian:
+ *
+ *   u8 op, u8 client_id, u8 flags, u8 reserved, u32 len, i32 code
+ *
+ * A request header is followed by len bytes of arguments: NUL-terminated
+ * names (device, then channel and attribute for READ/WRITE, trigger for
+ * SETTRIG), then the u32 words of the channel mask for OPEN. code holds the numeric
+ * argument of the command (byte count, samples count, timeout...). The
+ * payload of WRITE and WRITEBUF (code bytes) follows the arguments.
+ *
+ * Responses use TINYIIOD_OP_RESPONSE and echo the client_id. code is the
+ * value the text protocol would send, and len bytes of data follow: the
+ * value of READ or GETTRIG, the XML of PRINT, the version of VERSION, the
+ * compressed XML of ZPRINT (code then holds the uncompressed size) and,
+ * for READBUF, the samples preceded by the mask words in the first block.
+ * Blocks pushed by STREAM use TINYIIOD_OP_STREAM, code holds their size
+ * (or the error code ending the stream) and the data is preceded by the
+ * u32 sequence number.
+ */
+#define TINYIIOD_BINARY_HEADER_SIZE	12
+
+/* Channel masks are sent as 32-bit words, the most significant first in
+ * text mode (e.g. 64 channels: "%08x%08x") and the least significant
+ * first in binary mode. Word 0 always holds channels 0 to 31. */
+#ifndef TINYIIOD_MAX_MASK_WORDS
+#define TINYIIOD_MAX_MASK_WORDS 4
+#endif
+
+enum tinyiiod_opcode {
+	TINYIIOD_OP_RESPONSE = 0,
+	TINYIIOD_OP_VERSION,
+	TINYIIOD_OP_PRINT,
+	TINYIIOD_OP_ZPRINT,
+	TINYIIOD_OP_READ,
+	TINYIIOD_OP_WRITE,
+	TINYIIOD_OP_OPEN,
+	TINYIIOD_OP_CLOSE,
+	TINYIIOD_OP_READBUF,
+	TINYIIOD_OP_WRITEBUF,
+	TINYIIOD_OP_TIMEOUT,
+	TINYIIOD_OP_SET_BUFFERS_COUNT,
+	TINYIIOD_OP_GETTRIG,
+	TINYIIOD_OP_SETTRIG,
+	TINYIIOD_OP_EXIT,
+	TINYIIOD_OP_TEXT,
+	TINYIIOD_OP_STREAM,
+	TINYIIOD_OP_REARM,
+	TINYIIOD_OP_STOP,
+};
+
+#define TINYIIOD_NB_OPCODES	(TINYIIOD_OP_STOP + 1)
+
+/* Binary header flags. For READ and WRITE, bits 4-5 hold the
+ * enum iio_attr_type of non-channel attributes. */
+#define TINYIIOD_FLAG_CHANNEL	(1 << 0)
+#define TINYIIOD_FLAG_OUTPUT	(1 << 1)
+#define TINYIIOD_FLAG_CYCLIC	(1 << 0)
+#define TINYIIOD_FLAG_TYPE(x)	(((x) >> 4) & 0x3)
+
+struct tinyiiod_iovec {
+	const char *buf;
+	size_t len;
+};
+
+/*
+ * How long the value of an attribute read can be served again without
+ * asking the backend. Writes through the library drop the cached value;
+ * values bigger than IIOD_VALUE_SIZE are never cached.
+ */
+enum tinyiiod_cache_policy {
+	TINYIIOD_CACHE_NEVER,
+	TINYIIOD_CACHE_TTL,		/* Needs the get_time_us op */
+	TINYIIOD_CACHE_UNTIL_WRITTEN,
+};
+
+/*
+ * Callbacks of the original API, without any context: the backend state
+ * has to live in globals. Kept for existing backends, given to
+ * tinyiiod_create(); the optional ops added since are only available
+ * through struct tinyiiod_ops_priv.
+ */
 struct tinyiiod_ops {
 	/* Read from the input stream */
 	ssize_t (*read)(char *buf, size_t len);
@@ -82,11 +166,414 @@ struct tinyiiod_ops {
 
 	int32_t (*set_buffers_count)(const char *device, uint32_t buffers_count);
 
+	/* The XML stays owned by the backend, and must stay valid until the
+	 * instance is destroyed or tinyiiod_invalidate_xml() is called */
 	ssize_t (*get_xml)(char **outxml);
 };
 
+/*
+ * All the callbacks receive the priv pointer given to tinyiiod_create_priv()
+ * or tinyiiod_init(), so that a process can run one instance per board or
+ * per connection without keeping the backend state in globals.
+ */
+struct tinyiiod_ops_priv {
+	/* Read from the input stream */
+	ssize_t (*read)(void *priv, char *buf, size_t len);
+
+	/* Write to the output stream */
+	ssize_t (*write)(void *priv, const char *buf, size_t len);
+	ssize_t (*read_line)(void *priv, char *buf, size_t len);
+
+	/* Optional: read up to len bytes, returning as soon as some data is
+	 * available. When set, commands are received in bulk instead of one
+	 * byte per read() call. */
+	ssize_t (*read_avail)(void *priv, char *buf, size_t len);
+
+	/* Optional: return true when a read would not block. Needed to push
+	 * STREAM blocks from tinyiiod_read_command(). */
+	bool (*read_ready)(void *priv);
+
+	/* Optional: write several buffers to the output stream at once */
+	ssize_t (*writev)(void *priv, const struct tinyiiod_iovec *iov,
+			  size_t iovcnt);
+
+	ssize_t (*open_instance)(void *priv);
+
+	ssize_t (*close_instance)(void *priv);
+
+	ssize_t (*read_attr)(void *priv, const char *device, const char *attr,
+			     char *buf, size_t len, enum iio_attr_type type);
+	ssize_t (*write_attr)(void *priv, const char *device, const char *attr,
+			      const char *buf, size_t len, enum iio_attr_type type);
+
+	ssize_t (*ch_read_attr)(void *priv, const char *device,
+				const char *channel, bool ch_out,
+				const char *attr, char *buf, size_t len);
+	ssize_t (*ch_write_attr)(void *priv, const char *device,
+				 const char *channel, bool ch_out,
+				 const char *attr, const char *buf, size_t len);
+
+	/* Optional: resolve an attribute (channel is NULL for device, debug
+	 * and buffer attributes) to a handle. The handle is cached by the
+	 * library until tinyiiod_invalidate_xml(), and the following reads
+	 * and writes of that attribute go through read_attr_h() and
+	 * write_attr_h() without any name lookup. */
+	int32_t (*resolve_attr)(void *priv, const char *device,
+				const char *channel, bool ch_out,
+				const char *attr, enum iio_attr_type type,
+				uint32_t *handle);
+	ssize_t (*read_attr_h)(void *priv, uint32_t handle,
+			       char *buf, size_t len);
+	ssize_t (*write_attr_h)(void *priv, uint32_t handle,
+				const char *buf, size_t len);
+
+	/* Optional: access attribute values bigger than the buffer of the
+	 * library, one chunk at a time (channel is NULL for device, debug
+	 * and buffer attributes). read_attr_chunk() copies up to len bytes
+	 * of the value, from offset, and returns the number of bytes copied;
+	 * the call with offset 0 also sets *size to the full size of the
+	 * value. write_attr_chunk() receives the size bytes of a value in
+	 * order, and returns 0 or a negative error code. Either may return
+	 * -ENOSYS on the first chunk to have the attribute handled by the
+	 * regular ops, as long as its value fits in the buffer. */
+	ssize_t (*read_attr_chunk)(void *priv, const char *device,
+				   const char *channel, bool ch_out,
+				   const char *attr, enum iio_attr_type type,
+				   char *buf, size_t offset, size_t len,
+				   size_t *size);
+	int32_t (*write_attr_chunk)(void *priv, const char *device,
+				    const char *channel, bool ch_out,
+				    const char *attr, enum iio_attr_type type,
+				    const char *buf, size_t offset, size_t len,
+				    size_t size);
+
+	int32_t (*open)(void *priv, const char *device, size_t sample_size,
+			uint32_t mask, bool cyclic);
+	int32_t (*close)(void *priv, const char *device);
+
+	ssize_t (*transfer_dev_to_mem)(void *priv, const char *device,
+				       size_t bytes_count);
+	ssize_t (*read_data)(void *priv, const char *device, char *buf,
+			     size_t offset, size_t bytes_count);
+	/* Optional: point *buf to the captured data at the given offset and
+	 * return how many contiguous bytes (up to bytes_count) it holds.
+	 * When set, it is used instead of read_data() to avoid a copy. */
+	ssize_t (*get_data_ptr)(void *priv, const char *device, char **buf,
+				size_t offset, size_t bytes_count);
+	/* Optional: same as get_data_ptr(), for backends that always capture
+	 * all the channels. offset and bytes_count count full scans, and only
+	 * whole scans may be returned. The library extracts the channels
+	 * enabled by the client, using the scan elements of the context XML.
+	 * transfer_dev_to_mem() is then called with the size of full scans
+	 * too, and so are submit_block() and dequeue_block(). */
+	ssize_t (*get_scans_ptr)(void *priv, const char *device, char **buf,
+				 size_t offset, size_t bytes_count);
+
+	ssize_t (*transfer_mem_to_dev)(void *priv, const char *device,
+				       size_t bytes_count);
+	ssize_t (*write_data)(void *priv, const char *device, const char *buf,
+			      size_t offset, size_t bytes_count);
+	/* Optional: point *buf to the output buffer at the given offset and
+	 * return how many contiguous bytes (up to bytes_count) can be written
+	 * there. When set, the WRITEBUF payload is received straight into it
+	 * and write_data() is not used. */
+	ssize_t (*get_write_ptr)(void *priv, const char *device, char **buf,
+				 size_t offset, size_t bytes_count);
+	/* Optional: restart a cyclic output buffer, reopened since, with the
+	 * waveform of its last WRITEBUF, which the backend kept. Returns the
+	 * size of that waveform, -ENOENT if there is none. */
+	ssize_t (*rearm)(void *priv, const char *device);
+
+	/* Optional: asynchronous variants of transfer_dev_to_mem() and
+	 * transfer_mem_to_dev(), used instead of them by tinyiiod_feed().
+	 * They start the transfer and return -EINPROGRESS; the backend then
+	 * reports its end with tinyiiod_transfer_done(). Any other value means
+	 * that the transfer is already over, with that result. READBUF
+	 * pipelines and tinyiiod_read_command() keep the synchronous ops. */
+	ssize_t (*start_dev_to_mem)(void *priv, const char *device,
+				    size_t bytes_count);
+	ssize_t (*start_mem_to_dev)(void *priv, const char *device,
+				    size_t bytes_count);
+
+	int32_t (*get_mask)(void *priv, const char *device, uint32_t *mask);
+
+	/* Optional: variants of open() and get_mask() for devices with more
+	 * than 32 scan channels. get_mask_words() is called with *mask_words
+	 * set to the room available in mask, and sets it to the number of
+	 * words used. Without them, masks wider than 32 bits are rejected. */
+	int32_t (*open_mask)(void *priv, const char *device,
+			     size_t sample_size, const uint32_t *mask,
+			     size_t mask_words, bool cyclic);
+	int32_t (*get_mask_words)(void *priv, const char *device,
+				  uint32_t *mask, size_t *mask_words);
+
+	int32_t (*get_trigger)(void *priv, const char *device,
+			       char *trigger, size_t len);
+	int32_t (*set_trigger)(void *priv, const char *device,
+			       const char *trigger, size_t len);
+
+	int32_t (*set_timeout)(void *priv, uint32_t timeout);
+
+	int32_t (*set_buffers_count)(void *priv, const char *device,
+				     uint32_t buffers_count);
+
+	/* Optional pipelined capture, used by READBUF instead of
+	 * transfer_dev_to_mem() once the client asked for two buffers or more
+	 * with SET BUFFERS_COUNT. submit_block() starts filling the next free
+	 * block of the backend's ring with bytes_count bytes and returns
+	 * without waiting. dequeue_block() waits for the oldest submitted
+	 * block, points *buf to it and returns its size; the block stays
+	 * valid until the next submit_block() call, which recycles it.
+	 * *overrun is set when samples were lost before that block.
+	 * Queued blocks are dropped by the backend on open() and close(). */
+	int32_t (*submit_block)(void *priv, const char *device,
+				size_t bytes_count);
+	ssize_t (*dequeue_block)(void *priv, const char *device, char **buf,
+				 bool *overrun);
+
+	/* Return the context XML, which stays owned by the backend and can
+	 * be a constant string. It is only called when the library has no
+	 * copy, and the XML must stay valid until the library drops it, on
+	 * tinyiiod_invalidate_xml() or tinyiiod_destroy(). Returns the length
+	 * of the XML, or 0 to have it computed. Not used by instances given a
+	 * context description, see tinyiiod_set_context(). */
+	ssize_t (*get_xml)(void *priv, char **outxml);
+
+	/* Optional: called with the XML of get_xml() when the library drops
+	 * it, e.g. to free it */
+	void (*release_xml)(void *priv, char *xml);
+
+	/* Optional: monotonic time in microseconds, used to time commands
+	 * when the library is built with TINYIIOD_STATS, and to expire the
+	 * cached values of TINYIIOD_CACHE_TTL attributes. May wrap around. */
+	uint32_t (*get_time_us)(void *priv);
+
+	/* Optional: enables the cache of attribute values. Called once per
+	 * attribute (channel is NULL for device, debug and buffer
+	 * attributes), when it is first read; TINYIIOD_CACHE_TTL sets
+	 * *ttl_us. A cached read doesn't call the backend at all. */
+	enum tinyiiod_cache_policy (*get_cache_policy)(void *priv,
+			const char *device, const char *channel, bool ch_out,
+			const char *attr, enum iio_attr_type type,
+			uint32_t *ttl_us);
+};
+
+/* Instance of a backend written for the original API */
 TINYIIOD_API struct tinyiiod * tinyiiod_create(struct tinyiiod_ops *ops);
+TINYIIOD_API struct tinyiiod * tinyiiod_create_priv(
+		struct tinyiiod_ops_priv *ops, void *priv);
 TINYIIOD_API void tinyiiod_destroy(struct tinyiiod *iiod);
+
+/*
+ * Buffer sizes of an instance, in bytes; 0 keeps the build default.
+ * buffer_size bounds attribute values and the chunks of buffer data, and
+ * must be at least TINYIIOD_MIN_BUFFER_SIZE. rx_size and tx_size are the
+ * command read-ahead and the response staging. attr_cache_size counts
+ * entries, only used with resolve_attr(); value_cache_size as well, only
+ * used with get_cache_policy(). xml_size holds the context XML generated
+ * from a context description and the compressed XML of ZPRINT; only used
+ * by tinyiiod_init(), 0 means none.
+ */
+#define TINYIIOD_MIN_BUFFER_SIZE	64
+
+struct tinyiiod_config {
+	size_t buffer_size;
+	size_t rx_size;
+	size_t tx_size;
+	size_t attr_cache_size;
+	size_t value_cache_size;
+	size_t xml_size;
+};
+
+/* Memory needed by an instance with these ops and sizes (config may be
+ * NULL), as required by tinyiiod_init() */
+TINYIIOD_API size_t tinyiiod_mem_size(const struct tinyiiod_ops_priv *ops,
+				      const struct tinyiiod_config *config);
+
+/* Set up an instance in len bytes of caller-owned memory, aligned on 8
+ * bytes, without any heap allocation. The XML that doesn't fit in xml_size
+ * can't be generated or compressed, and -ENOSPC is replied instead.
+ * tinyiiod_destroy() leaves the memory to the caller. Returns NULL if the
+ * memory is too small or the sizes invalid. */
+TINYIIOD_API struct tinyiiod * tinyiiod_init(void *mem, size_t len,
+		struct tinyiiod_ops_priv *ops, void *priv,
+		const struct tinyiiod_config *config);
 TINYIIOD_API int32_t tinyiiod_read_command(struct tinyiiod *iiod);
 
+/* Non-blocking alternative to tinyiiod_read_command(), for event loops and
+ * interrupt-driven transports: process the len bytes in data, which can
+ * hold partial commands, several commands, or parts of their payload.
+ * Responses still go out through ops->write once each command is complete.
+ * Returns -EAGAIN while a command is only partially received, 0 otherwise;
+ * see tinyiiod_transfer_done() for the returns of a parked transfer. */
+TINYIIOD_API int32_t tinyiiod_feed(struct tinyiiod *iiod, const char *data,
+				   size_t len);
+
+/* Resume the READBUF or WRITEBUF command parked by an asynchronous transfer
+ * (see ops->start_dev_to_mem), with the result of the transfer: a negative
+ * error code, or anything else on success. Call it from the loop feeding
+ * the instance, not from an interrupt handler.
+ *
+ * While the command is parked, tinyiiod_feed() keeps the data in the
+ * receive buffer, to be processed here after the reply, and returns
+ * -EBUSY. When the receive buffer can't take all of it, tinyiiod_feed()
+ * returns the number of bytes it consumed instead, or -ENOSPC if none:
+ * the caller feeds the rest again after this call. Returns like
+ * tinyiiod_feed(), or -EINVAL if no transfer is pending. */
+TINYIIOD_API int32_t tinyiiod_transfer_done(struct tinyiiod *iiod,
+					    ssize_t ret);
+
+/*
+ * "STREAM <device> <bytes>" makes the daemon push blocks of the opened
+ * buffer until "STOP <device>", which leaves the buffer open, or CLOSE.
+ * "STREAM <device> 0" stops it as well. STOP replies -EBADF when no
+ * stream of that device is running, e.g. it already ended. The reply to
+ * STREAM is followed by the channel mask, once; every block then starts
+ * with its size and its sequence number on two lines. The sequence number
+ * skips one value when samples were lost before a block. In text mode, a
+ * line that doesn't hold the block size is the reply to the command that
+ * ended the stream. When capturing fails, the stream ends with a block
+ * header holding the negative error code instead of the size, and no
+ * data. A block that fails halfway through is first completed with
+ * zeroes.
+ *
+ * tinyiiod_stream_step() captures and sends the next block. Event loops
+ * call it whenever the transport can take more data; tinyiiod_read_command()
+ * calls it by itself while no command is waiting, which requires the
+ * read_ready op. Returns the block size, 0 when no stream is active, or a
+ * negative error code, which also ends the stream.
+ */
+TINYIIOD_API int32_t tinyiiod_stream_step(struct tinyiiod *iiod);
+
+/* Number of pipelined READBUF blocks that were preceded by lost samples */
+TINYIIOD_API uint32_t tinyiiod_get_overruns(struct tinyiiod *iiod);
+
+#ifdef TINYIIOD_STATS
+/*
+ * Per-command statistics, indexed by opcode (text commands included;
+ * unknown commands go to TINYIIOD_OP_RESPONSE, and the BINARY and TEXT
+ * switches of protocol both go to TINYIIOD_OP_TEXT). Bucket i of a histogram
+ * counts durations below 2^i microseconds, the last one everything above.
+ * parse is the time to decode the command, io the time spent in the
+ * transport ops and backend the rest of the handling. In tinyiiod_feed()
+ * mode, commands with a payload are timed until they wait for it.
+ *
+ * Reading the debug attribute TINYIIOD_STATS_ATTR of any device returns
+ * them as text, with the counters of the value cache; writing it resets
+ * them.
+ */
+#define TINYIIOD_STATS_BUCKETS	16
+#define TINYIIOD_STATS_ATTR	"tinyiiod_stats"
+
+struct tinyiiod_histogram {
+	uint32_t buckets[TINYIIOD_STATS_BUCKETS];
+};
+
+struct tinyiiod_op_stats {
+	uint32_t count, errors;
+	unsigned long long bytes;	/* READBUF, WRITEBUF and STREAM data */
+	struct tinyiiod_histogram parse, backend, io;
+};
+
+struct tinyiiod_stats {
+	struct tinyiiod_op_stats ops[TINYIIOD_NB_OPCODES];
+	uint32_t short_reads;		/* Captures returned in pieces */
+};
+
+TINYIIOD_API const struct tinyiiod_stats *
+tinyiiod_get_stats(struct tinyiiod *iiod);
+TINYIIOD_API void tinyiiod_reset_stats(struct tinyiiod *iiod);
+#endif
+
+/* Drop the cached context XML and attribute handles, e.g. after the device
+ * tree changed */
+TINYIIOD_API void tinyiiod_invalidate_xml(struct tinyiiod *iiod);
+
+/* Reads of cacheable attributes served from the cache, and the others */
+struct tinyiiod_cache_stats {
+	uint32_t hits, misses;
+};
+
+TINYIIOD_API const struct tinyiiod_cache_stats *
+tinyiiod_get_cache_stats(struct tinyiiod *iiod);
+
+/* Drop the cached attribute values, e.g. after the hardware changed them
+ * without a write through the library */
+TINYIIOD_API void tinyiiod_invalidate_values(struct tinyiiod *iiod);
+
+/*
+ * Static description of the devices, channels and attributes, instead of a
+ * hand-written XML and the strcmp() chains of the attribute ops. Tables are
+ * sorted with strcmp(): attributes by name, channels by ID (input before
+ * output for a same ID) and devices by ID, so that READ and WRITE are
+ * resolved with binary searches. Devices and channels can also be named,
+ * and are then found by name with a linear search.
+ */
+#define TINYIIOD_TABLE(array)	{ (array), sizeof(array) / sizeof((array)[0]) }
+
+struct tinyiiod_attr_desc {
+	const char *name;
+
+	/* NULL for write-only and read-only attributes */
+	ssize_t (*read)(void *priv, const struct tinyiiod_attr_desc *attr,
+			char *buf, size_t len);
+	ssize_t (*write)(void *priv, const struct tinyiiod_attr_desc *attr,
+			 const char *buf, size_t len);
+
+	/* For callbacks shared by several attributes */
+	const void *data;
+};
+
+struct tinyiiod_attr_table {
+	const struct tinyiiod_attr_desc *desc;
+	size_t nb;
+};
+
+struct tinyiiod_channel_desc {
+	const char *id, *name;
+	bool output;
+
+	/* Scan element, when format is set, e.g. "le:s16/16>>0" */
+	const char *format;
+	long index;
+
+	struct tinyiiod_attr_table attrs;
+};
+
+struct tinyiiod_channel_table {
+	const struct tinyiiod_channel_desc *desc;
+	size_t nb;
+};
+
+struct tinyiiod_device_desc {
+	const char *id, *name;
+	struct tinyiiod_channel_table channels;
+
+	/* Indexed by enum iio_attr_type */
+	struct tinyiiod_attr_table attrs[3];
+};
+
+struct tinyiiod_device_table {
+	const struct tinyiiod_device_desc *desc;
+	size_t nb;
+};
+
+struct tinyiiod_context_desc {
+	const char *name, *description;
+	struct tinyiiod_device_table devices;
+};
+
+/* Serve the context XML and the attributes from ctx, which must stay
+ * valid. The attribute ops are then not used, nor get_xml: the library
+ * generates the XML, on the heap or, for instances set up with
+ * tinyiiod_init(), in the xml_size bytes of their config. Returns -EINVAL
+ * if the tables are not sorted. */
+TINYIIOD_API int32_t tinyiiod_set_context(struct tinyiiod *iiod,
+		const struct tinyiiod_context_desc *ctx);
+
+/* Write the XML of ctx to buf, snprintf() style: returns its length, and
+ * what doesn't fit is left out. */
+TINYIIOD_API size_t tinyiiod_context_xml(const struct tinyiiod_context_desc *ctx,
+		char *buf, size_t len);
+
 #endif /* TINYIIOD_H */
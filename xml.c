@@ -0,0 +1,191 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2026 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+/*
+ * Just enough XML parsing to walk the context description returned by
+ * get_xml(): tags are found by name and their attributes read in place.
+ * Entities are not decoded.
+ */
+
+const char *tinyiiod_xml_find(const char *ptr, const char *end,
+			      const char *str)
+{
+	size_t len = strlen(str);
+
+	for (; ptr + len <= end; ptr++)
+		if (*ptr == *str && !strncmp(ptr, str, len))
+			return ptr;
+
+	return NULL;
+}
+
+const char *tinyiiod_xml_attr(const char *tag, const char *name, size_t *len)
+{
+	const char *end = strchr(tag, '>'), *ptr, *quote;
+	size_t name_len = strlen(name);
+
+	if (!end)
+		return NULL;
+
+	for (ptr = tag; (ptr = tinyiiod_xml_find(ptr, end, name));
+	     ptr += name_len) {
+		if (ptr[-1] != ' ' || ptr[name_len] != '=' ||
+		    ptr[name_len + 1] != '"')
+			continue;
+
+		ptr += name_len + 2;
+		quote = strchr(ptr, '"');
+		if (!quote)
+			return NULL;
+
+		*len = (size_t) (quote - ptr);
+		return ptr;
+	}
+
+	return NULL;
+}
+
+bool tinyiiod_xml_attr_is(const char *tag, const char *name,
+			  const char *value)
+{
+	size_t len;
+	const char *ptr = tinyiiod_xml_attr(tag, name, &len);
+
+	return ptr && len == strlen(value) && !strncmp(ptr, value, len);
+}
+
+/* End of the element starting at tag, or NULL */
+static const char *element_end(const char *tag, const char *end,
+			       const char *close)
+{
+	const char *ptr = strchr(tag, '>');
+
+	if (!ptr || ptr >= end)
+		return NULL;
+
+	/* Empty element */
+	if (ptr[-1] == '/')
+		return ptr + 1;
+
+	ptr = tinyiiod_xml_find(ptr, end, close);
+
+	return ptr ? ptr + strlen(close) : NULL;
+}
+
+const char *tinyiiod_xml_device(const char *xml, const char *device,
+				const char **end)
+{
+	const char *dev;
+
+	/* Devices are found by ID or by name, like in the commands */
+	for (dev = xml; (dev = strstr(dev, "<device ")); dev++)
+		if (tinyiiod_xml_attr_is(dev, "id", device) ||
+		    tinyiiod_xml_attr_is(dev, "name", device))
+			break;
+	if (!dev)
+		return NULL;
+
+	*end = element_end(dev, dev + strlen(dev), "</device>");
+
+	return *end ? dev : NULL;
+}
+
+int32_t tinyiiod_xml_attrs_init(struct tinyiiod_xml_attrs *it,
+				const char *xml, const char *device,
+				const char *channel, bool ch_out,
+				enum iio_attr_type type)
+{
+	const char *dev, *dev_end, *chn;
+
+	dev = tinyiiod_xml_device(xml, device, &dev_end);
+	if (!dev)
+		return -ENODEV;
+
+	it->skip_channels = !channel;
+
+	if (!channel) {
+		it->ptr = dev;
+		it->end = dev_end;
+
+		switch (type) {
+		case IIO_ATTR_TYPE_DEBUG:
+			it->tag = "<debug-attribute ";
+			break;
+		case IIO_ATTR_TYPE_BUFFER:
+			it->tag = "<buffer-attribute ";
+			break;
+		default:
+			it->tag = "<attribute ";
+			break;
+		}
+
+		return 0;
+	}
+
+	for (chn = dev; (chn = tinyiiod_xml_find(chn, dev_end, "<channel "));
+	     chn++) {
+		if (!tinyiiod_xml_attr_is(chn, "id", channel) &&
+		    !tinyiiod_xml_attr_is(chn, "name", channel))
+			continue;
+		if (!tinyiiod_xml_attr_is(chn, "type",
+					  ch_out ? "output" : "input"))
+			continue;
+
+		it->ptr = chn + 1;
+		it->end = element_end(chn, dev_end, "</channel>");
+		it->tag = "<attribute ";
+
+		return it->end ? 0 : -EINVAL;
+	}
+
+	return -ENOENT;
+}
+
+ssize_t tinyiiod_xml_next_attr(struct tinyiiod_xml_attrs *it,
+			       char *name, size_t len)
+{
+	const char *tag, *chn, *value;
+	size_t name_len;
+
+	while ((tag = tinyiiod_xml_find(it->ptr, it->end, it->tag))) {
+		/* Device attributes: skip those of the channels */
+		chn = it->skip_channels ?
+			tinyiiod_xml_find(it->ptr, tag, "<channel ") : NULL;
+		if (chn) {
+			it->ptr = element_end(chn, it->end, "</channel>");
+			if (!it->ptr)
+				return -EINVAL;
+			continue;
+		}
+
+		it->ptr = tag + 1;
+
+		value = tinyiiod_xml_attr(tag, "name", &name_len);
+		if (!value || name_len >= len)
+			return -EINVAL;
+
+		memcpy(name, value, name_len);
+		name[name_len] = '\0';
+
+		return (ssize_t) name_len;
+	}
+
+	return 0;
+}